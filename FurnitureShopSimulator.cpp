@@ -1,33 +1,265 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Building with -DDESIGN_PATTERNS_SEALED marks every concrete product and factory final,
+// so wherever the concrete type is visible the compiler can devirtualize the calls.
+// The default build leaves the hierarchy open for extension.
+#ifdef DESIGN_PATTERNS_SEALED
+#define SEALED final
+#else
+#define SEALED
+#endif
+
+// Every variant of the family is a style, and every product is of one kind.
+enum class FurnitureStyle : std::uint8_t { Modern, Victorian, ArtDeco };
+enum class FurnitureKind : std::uint8_t { Chair, Sofa, CoffeeTable };
+constexpr std::size_t furnitureStyleCount = 3;
+constexpr std::size_t furnitureKindCount = 3;
+
+constexpr bool isBuiltinStyle(FurnitureStyle style) {
+    return static_cast<std::size_t>(style) < furnitureStyleCount;
+}
+
+// Styles loaded at run time get ids from furnitureStyleCount up (see FurnitureStyleTable),
+// so every table indexed by style checks its argument with this first
+constexpr void requireBuiltinStyle(FurnitureStyle style) {
+    if (!isBuiltinStyle(style)) {
+        throw std::invalid_argument("not a built-in furniture style");
+    }
+}
+
+// Hot-path instrumentation, compiled in only with -DDESIGN_PATTERNS_INSTRUMENTATION.
+// Every product a factory creates and every product call is counted per style, and ClientCode
+// runs are timed into a log2 latency histogram. Each thread updates a block of counters
+// of its own, so probes never contend; snapshot() adds up the blocks of all threads,
+// including threads that have already exited. Without the define the probes compile to nothing.
+#ifdef DESIGN_PATTERNS_INSTRUMENTATION
+enum class Probe : std::uint8_t {
+    CreateChair, CreateSofa, CreateCoffeeTable, SitOn, LayOn, PutAside, CoffeeOnMe, SittingOn
+};
+
+class Instrumentation {
+public:
+    static constexpr std::size_t probeCount = 8;
+    static constexpr std::size_t latencyBuckets = 64;
+    static constexpr const char* probeNames[probeCount] = {
+        "create_chair", "create_sofa", "create_coffee_table", "sit_on",
+        "lay_on", "put_aside", "coffee_on_me", "sitting_on",
+    };
+
+    struct Snapshot {
+        std::uint64_t counts[furnitureStyleCount][probeCount] = {};
+        // Bucket b counts the ClientCode runs that took [2^b, 2^(b+1)) nanoseconds
+        std::uint64_t clientCodeLatency[latencyBuckets] = {};
+
+        // One "name{labels} value" line per metric, ready to be scraped
+        void print(std::ostream& out) const {
+            static const char* const styleNames[furnitureStyleCount] = {"modern", "victorian", "artdeco"};
+            for (std::size_t style = 0; style < furnitureStyleCount; ++style) {
+                for (std::size_t probe = 0; probe < probeCount; ++probe) {
+                    out<<"furniture_calls_total{style=\""<<styleNames[style]<<"\",call=\""<<probeNames[probe]
+                       <<"\"} "<<counts[style][probe]<<"\n";
+                }
+            }
+            for (std::size_t bucket = 0; bucket < latencyBuckets; ++bucket) {
+                if (clientCodeLatency[bucket] != 0) {
+                    out<<"client_code_latency_ns_bucket{lt=\""<<(std::uint64_t(1) << bucket) * 2<<"\"} "
+                       <<clientCodeLatency[bucket]<<"\n";
+                }
+            }
+        }
+    };
+
+    static void count(FurnitureStyle style, Probe probe, std::uint64_t n = 1) {
+        if (isBuiltinStyle(style)) {
+            increment(local().counts[static_cast<std::size_t>(style)][static_cast<std::size_t>(probe)], n);
+        }
+    }
+    // The create probes follow the order of FurnitureKind
+    static void countCreated(FurnitureStyle style, FurnitureKind kind, std::uint64_t n) {
+        count(style, static_cast<Probe>(static_cast<std::size_t>(Probe::CreateChair) + static_cast<std::size_t>(kind)), n);
+    }
+    static void recordClientCodeLatency(std::chrono::nanoseconds latency) {
+        std::size_t bucket = 0;
+        for (auto ns = static_cast<std::uint64_t>(latency.count()); ns > 1 && bucket + 1 < latencyBuckets; ns >>= 1) {
+            ++bucket;
+        }
+        increment(local().clientCodeLatency[bucket]);
+    }
+    static Snapshot snapshot() {
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        Snapshot result = all.retired;
+        for (const Block* block : all.live) {
+            addTo(result, *block);
+        }
+        return result;
+    }
+
+private:
+    struct Block {
+        std::atomic<std::uint64_t> counts[furnitureStyleCount][probeCount] = {};
+        std::atomic<std::uint64_t> clientCodeLatency[latencyBuckets] = {};
+    };
+    struct Registry {
+        std::mutex mutex;
+        std::vector<const Block*> live;
+        Snapshot retired;
+    };
+    // Registers the block of the thread and folds it into the retired totals when the thread exits
+    struct ThreadBlock {
+        Block block;
+        ThreadBlock() {
+            Registry& all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            all.live.push_back(&block);
+        }
+        ~ThreadBlock() {
+            Registry& all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            addTo(all.retired, block);
+            all.live.erase(std::find(all.live.begin(), all.live.end(), &block));
+        }
+    };
+
+    static Registry& registry() {
+        static Registry all;
+        return all;
+    }
+    static Block& local() {
+        thread_local ThreadBlock threadBlock;
+        return threadBlock.block;
+    }
+    // Only the owning thread writes a counter, so a plain load and store is enough
+    static void increment(std::atomic<std::uint64_t>& counter, std::uint64_t n = 1) {
+        counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+    static void addTo(Snapshot& snapshot, const Block& block) {
+        for (std::size_t style = 0; style < furnitureStyleCount; ++style) {
+            for (std::size_t probe = 0; probe < probeCount; ++probe) {
+                snapshot.counts[style][probe] += block.counts[style][probe].load(std::memory_order_relaxed);
+            }
+        }
+        for (std::size_t bucket = 0; bucket < latencyBuckets; ++bucket) {
+            snapshot.clientCodeLatency[bucket] += block.clientCodeLatency[bucket].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+// Times the enclosing scope into the ClientCode latency histogram
+class ClientCodeTimer {
+public:
+    ClientCodeTimer() : start_(std::chrono::steady_clock::now()) { }
+    ~ClientCodeTimer() {
+        Instrumentation::recordClientCodeLatency(std::chrono::steady_clock::now() - start_);
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+#define FURNITURE_PROBE(style, probe) Instrumentation::count(FurnitureStyle::style, Probe::probe)
+#define FURNITURE_COUNT_CREATED(style, kind, n) Instrumentation::countCreated(style, kind, n)
+#define FURNITURE_TIME_CLIENT_CODE() const ClientCodeTimer clientCodeTimer
+#else
+#define FURNITURE_PROBE(style, probe) ((void)0)
+#define FURNITURE_COUNT_CREATED(style, kind, n) ((void)0)
+#define FURNITURE_TIME_CLIENT_CODE() ((void)0)
+#endif
 
 // Each distict product of a product family must have a base interface 
 // All variants of the product must inplement this interface
+// Besides returning a new std::string, every product can expose its fixed message
+// as a std::string_view to static storage, and append composed messages to a
+// caller-provided buffer, so rendering a set allocates nothing once the buffer is big enough.
+// The messages composed from two collaborating products are memoized at compile time,
+// see PutAsideMessages and SittingOnMessages below.
 
 // Abstruct Product CHAIR
 class Chair {
 public:
     virtual ~Chair() { }
     virtual std::string sitOn() const  = 0;
+    virtual std::string_view sitOnView() const = 0;
+    virtual FurnitureStyle style() const = 0;
 };
 
-class ModernChair : public Chair {
+class ModernChair SEALED : public Chair {
 public:
+    static constexpr std::string_view sitOnMessage = "You can sit on MODERN chair\n";
     std::string sitOn() const override {
-        return "You can sit on MODERN chair\n";
+        FURNITURE_PROBE(Modern, SitOn);
+        return std::string(sitOnMessage);
+    }
+    std::string_view sitOnView() const override {
+        FURNITURE_PROBE(Modern, SitOn);
+        return sitOnMessage;
+    }
+    FurnitureStyle style() const override {
+        return FurnitureStyle::Modern;
     }
 };
 
-class VictorianChair : public Chair {
+class VictorianChair SEALED : public Chair {
 public:
+    static constexpr std::string_view sitOnMessage = "You can sit on VICTORIAN chair\n";
     std::string sitOn() const override {
-        return "You can sit on VICTORIAN chair\n";
+        FURNITURE_PROBE(Victorian, SitOn);
+        return std::string(sitOnMessage);
+    }
+    std::string_view sitOnView() const override {
+        FURNITURE_PROBE(Victorian, SitOn);
+        return sitOnMessage;
+    }
+    FurnitureStyle style() const override {
+        return FurnitureStyle::Victorian;
     }
 };
 
-class ArtDecoChair : public Chair {
+class ArtDecoChair SEALED : public Chair {
 public: 
+    static constexpr std::string_view sitOnMessage = "You can sit on ARTDECO chair\n";
     std::string sitOn() const override {
-        return "You can sit on ARTDECO chair\n";
+        FURNITURE_PROBE(ArtDeco, SitOn);
+        return std::string(sitOnMessage);
+    }
+    std::string_view sitOnView() const override {
+        FURNITURE_PROBE(ArtDeco, SitOn);
+        return sitOnMessage;
+    }
+    FurnitureStyle style() const override {
+        return FurnitureStyle::ArtDeco;
     }
 };
 
@@ -40,38 +272,107 @@ public:
     virtual ~Sofa() { }
     virtual std::string layOn() const  = 0;
     virtual std::string putAside(const Chair& collaborator) const = 0; 
+    virtual std::string_view layOnView() const = 0;
+    // The putAside message from static storage; empty when the collaborator is not of a built-in style
+    virtual std::string_view putAsideView(const Chair& collaborator) const = 0;
+    // Appends the putAside message to out
+    virtual void putAside(const Chair& collaborator, std::string& out) const = 0;
+    virtual FurnitureStyle style() const = 0;
 };
 
-class ModernSofa : public Sofa {
+class ModernSofa SEALED : public Sofa {
 public:
+    static constexpr std::string_view layOnMessage = "You can lie on MODERN Sofa\n";
+    static constexpr std::string_view putAsideMessage = "Now you can lie on Modern Sofa and ";
     std::string layOn() const override {
-        return "You can lie on MODERN Sofa\n";
+        FURNITURE_PROBE(Modern, LayOn);
+        return std::string(layOnMessage);
     }
     std::string putAside(const Chair& collaboratorChair) const override {
-        const std::string result = collaboratorChair.sitOn();
-        return "Now you can lie on Modern Sofa and " + result;
+        std::string result;
+        putAside(collaboratorChair, result);
+        return result;
+    }
+    std::string_view layOnView() const override {
+        FURNITURE_PROBE(Modern, LayOn);
+        return layOnMessage;
+    }
+    std::string_view putAsideView(const Chair& collaboratorChair) const override;
+    void putAside(const Chair& collaboratorChair, std::string& out) const override {
+        const std::string_view message = putAsideView(collaboratorChair);
+        if (!message.empty()) {
+            out.append(message);
+            return;
+        }
+        out.append(putAsideMessage);
+        out.append(collaboratorChair.sitOnView());
+    }
+    FurnitureStyle style() const override {
+        return FurnitureStyle::Modern;
     }
 };
 
-class VictorianSofa : public Sofa {
+class VictorianSofa SEALED : public Sofa {
 public:
+    static constexpr std::string_view layOnMessage = "You can lie on VICTORIAN Sofa\n";
+    static constexpr std::string_view putAsideMessage = "Now you can lie on Victorian sofa and ";
     std::string layOn() const override {
-        return "You can lie on VICTORIAN Sofa\n";
+        FURNITURE_PROBE(Victorian, LayOn);
+        return std::string(layOnMessage);
     }
     std::string putAside(const Chair& collaboratorChair) const override {
-        const std::string result = collaboratorChair.sitOn();
-        return "Now you can lie on Victorian sofa and " + result;
+        std::string result;
+        putAside(collaboratorChair, result);
+        return result;
+    }
+    std::string_view layOnView() const override {
+        FURNITURE_PROBE(Victorian, LayOn);
+        return layOnMessage;
+    }
+    std::string_view putAsideView(const Chair& collaboratorChair) const override;
+    void putAside(const Chair& collaboratorChair, std::string& out) const override {
+        const std::string_view message = putAsideView(collaboratorChair);
+        if (!message.empty()) {
+            out.append(message);
+            return;
+        }
+        out.append(putAsideMessage);
+        out.append(collaboratorChair.sitOnView());
+    }
+    FurnitureStyle style() const override {
+        return FurnitureStyle::Victorian;
     }
 };
 
-class ArtDecoSofa : public Sofa {
+class ArtDecoSofa SEALED : public Sofa {
 public: 
+    static constexpr std::string_view layOnMessage = "You can lie on ARTDECO Sofa\n";
+    static constexpr std::string_view putAsideMessage = "Now you can lie on ArdDeco sofa and ";
     std::string layOn() const override {
-        return "You can lie on ARTDECO Sofa\n";
+        FURNITURE_PROBE(ArtDeco, LayOn);
+        return std::string(layOnMessage);
     }
     std::string putAside(const Chair& collaboratorChair) const override {
-        const std::string result = collaboratorChair.sitOn();
-        return "Now you can lie on ArdDeco sofa and " + result;
+        std::string result;
+        putAside(collaboratorChair, result);
+        return result;
+    }
+    std::string_view layOnView() const override {
+        FURNITURE_PROBE(ArtDeco, LayOn);
+        return layOnMessage;
+    }
+    std::string_view putAsideView(const Chair& collaboratorChair) const override;
+    void putAside(const Chair& collaboratorChair, std::string& out) const override {
+        const std::string_view message = putAsideView(collaboratorChair);
+        if (!message.empty()) {
+            out.append(message);
+            return;
+        }
+        out.append(putAsideMessage);
+        out.append(collaboratorChair.sitOnView());
+    }
+    FurnitureStyle style() const override {
+        return FurnitureStyle::ArtDeco;
     }
 };
 
@@ -80,119 +381,3334 @@ public:
     virtual ~CoffeeTable() { }
     virtual std::string coffeeOnMe() const = 0;
     virtual std::string sittingOn(const Sofa& collaboratorSofa) const = 0;
+    virtual std::string_view coffeeOnMeView() const = 0;
+    // The sittingOn message from static storage; empty when the collaborator is not of a built-in style
+    virtual std::string_view sittingOnView(const Sofa& collaboratorSofa) const = 0;
+    // Appends the sittingOn message to out
+    virtual void sittingOn(const Sofa& collaboratorSofa, std::string& out) const = 0;
+    virtual FurnitureStyle style() const = 0;
 };
 
-class ModernCoffeeTable : public CoffeeTable {
+class ModernCoffeeTable SEALED : public CoffeeTable {
 public:
+    static constexpr std::string_view coffeeOnMeMessage = "You're enjoying a cup of coffee on Modern Coffee Table\n";
+    static constexpr std::string_view sittingOnMessage = "Enjoy your coffee on Modern Coffee Table\n";
     std::string coffeeOnMe() const override {
-        return "You're enjoying a cup of coffee on Modern Coffee Table\n";
+        FURNITURE_PROBE(Modern, CoffeeOnMe);
+        return std::string(coffeeOnMeMessage);
     }
     std::string sittingOn(const Sofa& collaboratorSofa) const override {
-        std::string result = collaboratorSofa.layOn();
-        return result + "Enjoy your coffee on Modern Coffee Table\n";
+        std::string result;
+        sittingOn(collaboratorSofa, result);
+        return result;
+    }
+    std::string_view coffeeOnMeView() const override {
+        FURNITURE_PROBE(Modern, CoffeeOnMe);
+        return coffeeOnMeMessage;
+    }
+    std::string_view sittingOnView(const Sofa& collaboratorSofa) const override;
+    void sittingOn(const Sofa& collaboratorSofa, std::string& out) const override {
+        const std::string_view message = sittingOnView(collaboratorSofa);
+        if (!message.empty()) {
+            out.append(message);
+            return;
+        }
+        out.append(collaboratorSofa.layOnView());
+        out.append(sittingOnMessage);
+    }
+    FurnitureStyle style() const override {
+        return FurnitureStyle::Modern;
     }
 };
 
-class VictorianCoffeeTable : public CoffeeTable {
+class VictorianCoffeeTable SEALED : public CoffeeTable {
 public:
+    static constexpr std::string_view coffeeOnMeMessage = "You're enjoying a cup of coffee on Victorian Coffee Table\n";
+    static constexpr std::string_view sittingOnMessage = "Enjoy your coffee on Victorian Coffee table\n";
     std::string coffeeOnMe() const override {
-        return "You're enjoying a cup of coffee on Victorian Coffee Table\n";
+        FURNITURE_PROBE(Victorian, CoffeeOnMe);
+        return std::string(coffeeOnMeMessage);
     }
     std::string sittingOn(const Sofa& collaboratorSofa) const override {
-        std::string result = collaboratorSofa.layOn();
-        return result + "Enjoy your coffee on Victorian Coffee table\n";
+        std::string result;
+        sittingOn(collaboratorSofa, result);
+        return result;
+    }
+    std::string_view coffeeOnMeView() const override {
+        FURNITURE_PROBE(Victorian, CoffeeOnMe);
+        return coffeeOnMeMessage;
+    }
+    std::string_view sittingOnView(const Sofa& collaboratorSofa) const override;
+    void sittingOn(const Sofa& collaboratorSofa, std::string& out) const override {
+        const std::string_view message = sittingOnView(collaboratorSofa);
+        if (!message.empty()) {
+            out.append(message);
+            return;
+        }
+        out.append(collaboratorSofa.layOnView());
+        out.append(sittingOnMessage);
+    }
+    FurnitureStyle style() const override {
+        return FurnitureStyle::Victorian;
     }
 };
 
-class ArtDecoCoffeeTable : public CoffeeTable {
+class ArtDecoCoffeeTable SEALED : public CoffeeTable {
 public:
+    static constexpr std::string_view coffeeOnMeMessage = "You're enjoying a cup of coffee on ArtDeco coffee table\n";
+    static constexpr std::string_view sittingOnMessage = "Enjoy your coffee on ArtDeco coffee table\n";
     std::string coffeeOnMe() const override {
-        return "You're enjoying a cup of coffee on ArtDeco coffee table\n";
+        FURNITURE_PROBE(ArtDeco, CoffeeOnMe);
+        return std::string(coffeeOnMeMessage);
     }
     std::string sittingOn(const Sofa& collaboratorSofa) const override {
-        std::string result = collaboratorSofa.layOn();
-        return result + "Enjoy your coffee on ArtDeco coffee table\n";
+        std::string result;
+        sittingOn(collaboratorSofa, result);
+        return result;
+    }
+    std::string_view coffeeOnMeView() const override {
+        FURNITURE_PROBE(ArtDeco, CoffeeOnMe);
+        return coffeeOnMeMessage;
+    }
+    std::string_view sittingOnView(const Sofa& collaboratorSofa) const override;
+    void sittingOn(const Sofa& collaboratorSofa, std::string& out) const override {
+        const std::string_view message = sittingOnView(collaboratorSofa);
+        if (!message.empty()) {
+            out.append(message);
+            return;
+        }
+        out.append(collaboratorSofa.layOnView());
+        out.append(sittingOnMessage);
+    }
+    FurnitureStyle style() const override {
+        return FurnitureStyle::ArtDeco;
     }
 };
 
-// Abstract Factory interface declares a set of methods that return different abstract products
-class FurnitureFactory {
+// Joins compile-time strings into one static array, so a composed message costs
+// nothing at run time.
+template <const std::string_view&... Parts>
+struct JoinedMessage {
+    static constexpr std::array<char, (Parts.size() + ...)> storage = [] {
+        std::array<char, (Parts.size() + ...)> joined {};
+        std::size_t length = 0;
+        for (const std::string_view part : {Parts...}) {
+            for (const char c : part) {
+                joined[length++] = c;
+            }
+        }
+        return joined;
+    }();
+    static constexpr std::string_view value {storage.data(), storage.size()};
+};
+
+// Whatever sofa and chair meet, putAside yields one of 3 messages per sofa, and
+// sittingOn one of 3 per coffee table, so both are looked up by the collaborator's style.
+template <typename SofaType>
+struct PutAsideMessages {
+    static constexpr std::string_view byChairStyle[furnitureStyleCount] = {
+        JoinedMessage<SofaType::putAsideMessage, ModernChair::sitOnMessage>::value,
+        JoinedMessage<SofaType::putAsideMessage, VictorianChair::sitOnMessage>::value,
+        JoinedMessage<SofaType::putAsideMessage, ArtDecoChair::sitOnMessage>::value,
+    };
+    static std::string_view lookup(const Chair& collaboratorChair) {
+        const FurnitureStyle style = collaboratorChair.style();
+        return isBuiltinStyle(style) ? byChairStyle[static_cast<std::size_t>(style)] : std::string_view();
+    }
+};
+
+template <typename CoffeeTableType>
+struct SittingOnMessages {
+    static constexpr std::string_view bySofaStyle[furnitureStyleCount] = {
+        JoinedMessage<ModernSofa::layOnMessage, CoffeeTableType::sittingOnMessage>::value,
+        JoinedMessage<VictorianSofa::layOnMessage, CoffeeTableType::sittingOnMessage>::value,
+        JoinedMessage<ArtDecoSofa::layOnMessage, CoffeeTableType::sittingOnMessage>::value,
+    };
+    static std::string_view lookup(const Sofa& collaboratorSofa) {
+        const FurnitureStyle style = collaboratorSofa.style();
+        return isBuiltinStyle(style) ? bySofaStyle[static_cast<std::size_t>(style)] : std::string_view();
+    }
+};
+
+std::string_view ModernSofa::putAsideView(const Chair& collaboratorChair) const {
+    FURNITURE_PROBE(Modern, PutAside);
+    return PutAsideMessages<ModernSofa>::lookup(collaboratorChair);
+}
+std::string_view VictorianSofa::putAsideView(const Chair& collaboratorChair) const {
+    FURNITURE_PROBE(Victorian, PutAside);
+    return PutAsideMessages<VictorianSofa>::lookup(collaboratorChair);
+}
+std::string_view ArtDecoSofa::putAsideView(const Chair& collaboratorChair) const {
+    FURNITURE_PROBE(ArtDeco, PutAside);
+    return PutAsideMessages<ArtDecoSofa>::lookup(collaboratorChair);
+}
+std::string_view ModernCoffeeTable::sittingOnView(const Sofa& collaboratorSofa) const {
+    FURNITURE_PROBE(Modern, SittingOn);
+    return SittingOnMessages<ModernCoffeeTable>::lookup(collaboratorSofa);
+}
+std::string_view VictorianCoffeeTable::sittingOnView(const Sofa& collaboratorSofa) const {
+    FURNITURE_PROBE(Victorian, SittingOn);
+    return SittingOnMessages<VictorianCoffeeTable>::lookup(collaboratorSofa);
+}
+std::string_view ArtDecoCoffeeTable::sittingOnView(const Sofa& collaboratorSofa) const {
+    FURNITURE_PROBE(ArtDeco, SittingOn);
+    return SittingOnMessages<ArtDecoCoffeeTable>::lookup(collaboratorSofa);
+}
+
+// Renders a whole set into out, in the same order as ClientCode prints it.
+// Nothing is allocated if out already has room for the messages.
+void renderFurniture(const Chair& chair, const Sofa& sofa, const CoffeeTable& coffeetable, std::string& out) {
+    out.append(chair.sitOnView());
+    out.append(sofa.layOnView());
+    sofa.putAside(chair, out);
+    out.append(coffeetable.coffeeOnMeView());
+    coffeetable.sittingOn(sofa, out);
+}
+
+// FurnitureTraits maps every style to its concrete products.
+template <FurnitureStyle Style>
+struct FurnitureTraits;
+
+template <>
+struct FurnitureTraits<FurnitureStyle::Modern> {
+    using ChairType = ModernChair;
+    using SofaType = ModernSofa;
+    using CoffeeTableType = ModernCoffeeTable;
+};
+
+template <>
+struct FurnitureTraits<FurnitureStyle::Victorian> {
+    using ChairType = VictorianChair;
+    using SofaType = VictorianSofa;
+    using CoffeeTableType = VictorianCoffeeTable;
+};
+
+template <>
+struct FurnitureTraits<FurnitureStyle::ArtDeco> {
+    using ChairType = ArtDecoChair;
+    using SofaType = ArtDecoSofa;
+    using CoffeeTableType = ArtDecoCoffeeTable;
+};
+
+// The messages of a style defined at run time, as slices of the message pool of the
+// FurnitureStyleTable it was loaded into. putAsideWithChair and sittingOnWithSofa are the
+// collaboration messages for products of the same style, joined once when the style is loaded.
+// Ids are only unique within one table, so two styles are the same only if their messages
+// are the same slices of the same pool.
+struct DataDrivenStyle {
+    FurnitureStyle id;
+    std::string_view name;
+    std::string_view sitOn;
+    std::string_view layOn;
+    std::string_view putAside;
+    std::string_view coffeeOnMe;
+    std::string_view sittingOn;
+    std::string_view putAsideWithChair;
+    std::string_view sittingOnWithSofa;
+};
+
+// One product class per kind serves every data-driven style: a product is only a pointer
+// to its style, so it is as small as a hand-written product plus one word.
+class DataDrivenChair SEALED : public Chair {
 public:
-    virtual Chair* createChair() const = 0;
-    virtual Sofa* createSofa() const = 0;
-    virtual CoffeeTable* createCoffeeTable() const = 0;
+    explicit DataDrivenChair(const DataDrivenStyle& style) : style_(&style) { }
+    std::string sitOn() const override {
+        return std::string(style_->sitOn);
+    }
+    std::string_view sitOnView() const override {
+        return style_->sitOn;
+    }
+    FurnitureStyle style() const override {
+        return style_->id;
+    }
+
+private:
+    const DataDrivenStyle* style_;
 };
 
-// Concrete Factories produce a family of products that belong to a single variant!
-// The factory guarantees that resulting products are compatible. Note
-// that signatures of the Concrete Factory's methods return an abstract product,
-// while inside the method a concrete product is instantiated.
-class ModernFurnitureFactory : public FurnitureFactory {
+class DataDrivenSofa SEALED : public Sofa {
 public:
-    Chair* createChair() const override {
-        return new ModernChair;
+    explicit DataDrivenSofa(const DataDrivenStyle& style) : style_(&style) { }
+    std::string layOn() const override {
+        return std::string(style_->layOn);
     }
-    Sofa* createSofa() const override {
-        return new ModernSofa;
+    std::string putAside(const Chair& collaboratorChair) const override {
+        std::string result;
+        putAside(collaboratorChair, result);
+        return result;
     }
-    CoffeeTable* createCoffeeTable() const override {
-        return new ModernCoffeeTable;
+    std::string_view layOnView() const override {
+        return style_->layOn;
     }
+    // Only the message for a chair of the same style is joined in advance. Another table may
+    // have given out the same id, so the chair's message must also be this style's slice.
+    std::string_view putAsideView(const Chair& collaboratorChair) const override {
+        return collaboratorChair.style() == style_->id && collaboratorChair.sitOnView().data() == style_->sitOn.data()
+                   ? style_->putAsideWithChair
+                   : std::string_view();
+    }
+    void putAside(const Chair& collaboratorChair, std::string& out) const override {
+        const std::string_view message = putAsideView(collaboratorChair);
+        if (!message.empty()) {
+            out.append(message);
+            return;
+        }
+        out.append(style_->putAside);
+        out.append(collaboratorChair.sitOnView());
+    }
+    FurnitureStyle style() const override {
+        return style_->id;
+    }
+
+private:
+    const DataDrivenStyle* style_;
 };
 
-class VictorianFurnitureFactory : public FurnitureFactory {
+class DataDrivenCoffeeTable SEALED : public CoffeeTable {
 public:
-    Chair* createChair() const override {
-        return new VictorianChair;
+    explicit DataDrivenCoffeeTable(const DataDrivenStyle& style) : style_(&style) { }
+    std::string coffeeOnMe() const override {
+        return std::string(style_->coffeeOnMe);
     }
-    Sofa* createSofa() const override {
-        return new VictorianSofa;
+    std::string sittingOn(const Sofa& collaboratorSofa) const override {
+        std::string result;
+        sittingOn(collaboratorSofa, result);
+        return result;
     }
-    CoffeeTable* createCoffeeTable() const override {
-        return new VictorianCoffeeTable;
+    std::string_view coffeeOnMeView() const override {
+        return style_->coffeeOnMe;
     }
+    // Only the message for a sofa of the same style is joined in advance, checked like putAsideView
+    std::string_view sittingOnView(const Sofa& collaboratorSofa) const override {
+        return collaboratorSofa.style() == style_->id && collaboratorSofa.layOnView().data() == style_->layOn.data()
+                   ? style_->sittingOnWithSofa
+                   : std::string_view();
+    }
+    void sittingOn(const Sofa& collaboratorSofa, std::string& out) const override {
+        const std::string_view message = sittingOnView(collaboratorSofa);
+        if (!message.empty()) {
+            out.append(message);
+            return;
+        }
+        out.append(collaboratorSofa.layOnView());
+        out.append(style_->sittingOn);
+    }
+    FurnitureStyle style() const override {
+        return style_->id;
+    }
+
+private:
+    const DataDrivenStyle* style_;
 };
 
-class ArtDecoFurnitureFactory : public FurnitureFactory {
+// The product classes are closed: three built-in styles times three kinds, plus one class
+// per kind for all data-driven styles. A variant of the concrete products stores them by value,
+// so sets can sit in contiguous containers and are dispatched with std::visit instead of chasing pointers.
+using AnyChair = std::variant<ModernChair, VictorianChair, ArtDecoChair, DataDrivenChair>;
+using AnySofa = std::variant<ModernSofa, VictorianSofa, ArtDecoSofa, DataDrivenSofa>;
+using AnyCoffeeTable = std::variant<ModernCoffeeTable, VictorianCoffeeTable, ArtDecoCoffeeTable, DataDrivenCoffeeTable>;
+
+// Views any product held in a variant through its abstract interface.
+template <typename Product>
+struct AsProduct {
+    template <typename Concrete>
+    const Product& operator()(const Concrete& product) const { return product; }
+};
+
+// N complete sets of a single style, stored as a structure of arrays:
+// all chairs are contiguous, then all sofas, then all coffee tables.
+// Set i is chair(i), sofa(i) and coffeeTable(i).
+class FurnitureSetBatch {
 public:
-    Chair* createChair() const override {
-        return new ArtDecoChair;
+    template <FurnitureStyle Style>
+    static FurnitureSetBatch create(std::size_t count) {
+        using Traits = FurnitureTraits<Style>;
+        FurnitureSetBatch batch(Style);
+        batch.chairs_.assign(count, typename Traits::ChairType());
+        batch.sofas_.assign(count, typename Traits::SofaType());
+        batch.coffeeTables_.assign(count, typename Traits::CoffeeTableType());
+        FURNITURE_COUNT_CREATED(Style, FurnitureKind::Chair, count);
+        FURNITURE_COUNT_CREATED(Style, FurnitureKind::Sofa, count);
+        FURNITURE_COUNT_CREATED(Style, FurnitureKind::CoffeeTable, count);
+        return batch;
     }
-    Sofa* createSofa() const override {
-        return new ArtDecoSofa;
+    static FurnitureSetBatch create(const DataDrivenStyle& style, std::size_t count) {
+        FurnitureSetBatch batch(style.id);
+        batch.chairs_.assign(count, DataDrivenChair(style));
+        batch.sofas_.assign(count, DataDrivenSofa(style));
+        batch.coffeeTables_.assign(count, DataDrivenCoffeeTable(style));
+        return batch;
     }
-    CoffeeTable* createCoffeeTable() const override {
-        return new ArtDecoCoffeeTable;
+
+    FurnitureStyle style() const { return style_; }
+    std::size_t size() const { return chairs_.size(); }
+    const Chair& chair(std::size_t i) const { return std::visit(AsProduct<Chair>(), chairs_[i]); }
+    const Sofa& sofa(std::size_t i) const { return std::visit(AsProduct<Sofa>(), sofas_[i]); }
+    const CoffeeTable& coffeeTable(std::size_t i) const {
+        return std::visit(AsProduct<CoffeeTable>(), coffeeTables_[i]);
     }
+    const std::vector<AnyChair>& chairs() const { return chairs_; }
+    const std::vector<AnySofa>& sofas() const { return sofas_; }
+    const std::vector<AnyCoffeeTable>& coffeeTables() const { return coffeeTables_; }
+
+private:
+    explicit FurnitureSetBatch(FurnitureStyle style) : style_(style) { }
+
+    FurnitureStyle style_;
+    std::vector<AnyChair> chairs_;
+    std::vector<AnySofa> sofas_;
+    std::vector<AnyCoffeeTable> coffeeTables_;
 };
 
-void ClientCode(const FurnitureFactory& factory) {
-    const Chair* chair = factory.createChair();
-    const Sofa* sofa = factory.createSofa();
-    const CoffeeTable* coffeetable = factory.createCoffeeTable();
-    std::cout<<chair->sitOn();
-    std::cout<<sofa->layOn();
-    std::cout<<sofa->putAside(*chair);
-    std::cout<<coffeetable->coffeeOnMe();
-    std::cout<<coffeetable->sittingOn(*sofa);
-    delete chair;
-    delete sofa;
-    delete coffeetable;
+void renderFurniture(const FurnitureSetBatch& batch, std::string& out) {
+    for (std::size_t i = 0; i < batch.size(); ++i) {
+        renderFurniture(batch.chair(i), batch.sofa(i), batch.coffeeTable(i), out);
+    }
 }
 
-int main()
-{
-    std::cout<<"Client's code testing with the Modern Furniture factory\n";
-    FurnitureFactory* modernFurnitureFactory = new ModernFurnitureFactory;
-    ClientCode(*modernFurnitureFactory);
-    delete modernFurnitureFactory;
-    std::cout<<"\nTesting Victorian Furniture factory\n";
-    FurnitureFactory* victorianFurnitureFactory = new VictorianFurnitureFactory;
-    ClientCode(*victorianFurnitureFactory);
-    delete victorianFurnitureFactory;
-    std::cout<<"\nTesting ArtDeco Furniture factory\n";
-    FurnitureFactory* artDecoFurnitureFactory = new ArtDecoFurnitureFactory;
-    ClientCode(*artDecoFurnitureFactory);
-    delete artDecoFurnitureFactory;
+// Writes count copies of fragment to destination. After the first copy the filled part is
+// copied onto the rest in doubling steps, so the work is a handful of large memcpy calls,
+// which libc already runs with the widest vector moves of the machine.
+void fillRepeated(char* destination, std::string_view fragment, std::size_t count) {
+    const std::size_t total = fragment.size() * count;
+    if (total == 0) {
+        return;
+    }
+    std::memcpy(destination, fragment.data(), fragment.size());
+    for (std::size_t filled = fragment.size(); filled < total;) {
+        const std::size_t chunk = std::min(filled, total - filled);
+        std::memcpy(destination + filled, destination, chunk);
+        filled += chunk;
+    }
+}
+
+// Same output as rendering every batch in turn, laid out in bulk: all sets of a batch
+// render to the same text, so each batch is rendered once, the prefix sums of the batch
+// lengths give every batch its offset, out grows once and each batch is filled in place.
+void renderFurnitureBulk(const std::vector<FurnitureSetBatch>& batches, std::string& out) {
+    std::vector<std::string> fragments(batches.size());
+    std::vector<std::size_t> offsets(batches.size());
+    for (std::size_t b = 0; b < batches.size(); ++b) {
+        if (batches[b].size() != 0) {
+            renderFurniture(batches[b].chair(0), batches[b].sofa(0), batches[b].coffeeTable(0), fragments[b]);
+        }
+        offsets[b] = fragments[b].size() * batches[b].size();
+    }
+    const std::size_t total = std::accumulate(offsets.begin(), offsets.end(), std::size_t{0});
+    std::exclusive_scan(offsets.begin(), offsets.end(), offsets.begin(), out.size());
+    out.resize(out.size() + total);
+    for (std::size_t b = 0; b < batches.size(); ++b) {
+        fillRepeated(&out[0] + offsets[b], fragments[b], batches[b].size());
+    }
+}
+
+// The fixed message of every (style, kind): sitOn for chairs, layOn for sofas
+// and coffeeOnMe for coffee tables. Empty for a style defined at run time.
+std::string_view productMessage(FurnitureStyle style, FurnitureKind kind) {
+    static constexpr std::string_view messages[furnitureStyleCount][furnitureKindCount] = {
+        {ModernChair::sitOnMessage, ModernSofa::layOnMessage, ModernCoffeeTable::coffeeOnMeMessage},
+        {VictorianChair::sitOnMessage, VictorianSofa::layOnMessage, VictorianCoffeeTable::coffeeOnMeMessage},
+        {ArtDecoChair::sitOnMessage, ArtDecoSofa::layOnMessage, ArtDecoCoffeeTable::coffeeOnMeMessage},
+    };
+    return isBuiltinStyle(style) ? messages[static_cast<std::size_t>(style)][static_cast<std::size_t>(kind)]
+                                 : std::string_view();
+}
+
+// A FurnitureCatalog keeps products grouped by style and kind in contiguous arrays.
+// The group is the type tag and every item is only its compact payload (a SKU),
+// so scanning or rendering the catalog is a linear sweep over a few arrays
+// instead of a walk over individually allocated objects.
+// Only the built-in styles have groups: any other style throws std::invalid_argument.
+class FurnitureCatalog {
+public:
+    void add(FurnitureStyle style, FurnitureKind kind, std::uint32_t sku) {
+        group(style, kind).push_back(sku);
+    }
+    void reserve(FurnitureStyle style, FurnitureKind kind, std::size_t count) {
+        group(style, kind).reserve(count);
+    }
+    std::size_t size() const {
+        std::size_t total = 0;
+        for (const auto& byKind : groups_) {
+            for (const auto& skus : byKind) {
+                total += skus.size();
+            }
+        }
+        return total;
+    }
+    const std::vector<std::uint32_t>& items(FurnitureStyle style, FurnitureKind kind) const {
+        requireBuiltinStyle(style);
+        return groups_[static_cast<std::size_t>(style)][static_cast<std::size_t>(kind)];
+    }
+
+    // Calls visitor(style, kind, sku) for every item, group by group.
+    template <typename Visitor>
+    void forEach(Visitor visitor) const {
+        for (std::size_t style = 0; style < furnitureStyleCount; ++style) {
+            for (std::size_t kind = 0; kind < furnitureKindCount; ++kind) {
+                for (const std::uint32_t sku : groups_[style][kind]) {
+                    visitor(static_cast<FurnitureStyle>(style), static_cast<FurnitureKind>(kind), sku);
+                }
+            }
+        }
+    }
+
+    // Appends the sitOn/layOn/coffeeOnMe message of every item to out,
+    // growing out at most once and filling every group with fillRepeated.
+    void render(std::string& out) const {
+        std::size_t length = 0;
+        forEachGroup([&length](std::string_view message, std::size_t count) { length += message.size() * count; });
+        std::size_t offset = out.size();
+        out.resize(out.size() + length);
+        forEachGroup([&out, &offset](std::string_view message, std::size_t count) {
+            fillRepeated(&out[0] + offset, message, count);
+            offset += message.size() * count;
+        });
+    }
+
+private:
+    std::vector<std::uint32_t>& group(FurnitureStyle style, FurnitureKind kind) {
+        requireBuiltinStyle(style);
+        return groups_[static_cast<std::size_t>(style)][static_cast<std::size_t>(kind)];
+    }
+    template <typename Callback>
+    void forEachGroup(Callback callback) const {
+        for (std::size_t style = 0; style < furnitureStyleCount; ++style) {
+            for (std::size_t kind = 0; kind < furnitureKindCount; ++kind) {
+                callback(productMessage(static_cast<FurnitureStyle>(style), static_cast<FurnitureKind>(kind)),
+                         groups_[style][kind].size());
+            }
+        }
+    }
+
+    std::vector<std::uint32_t> groups_[furnitureStyleCount][furnitureKindCount];
+};
+
+// The collaboration message of every (style, kind): the putAside prefix for sofas
+// and the sittingOn suffix for coffee tables. Chairs do not collaborate, and neither
+// do styles defined at run time.
+std::string_view collaborationMessage(FurnitureStyle style, FurnitureKind kind) {
+    static constexpr std::string_view messages[furnitureStyleCount][furnitureKindCount] = {
+        {{}, ModernSofa::putAsideMessage, ModernCoffeeTable::sittingOnMessage},
+        {{}, VictorianSofa::putAsideMessage, VictorianCoffeeTable::sittingOnMessage},
+        {{}, ArtDecoSofa::putAsideMessage, ArtDecoCoffeeTable::sittingOnMessage},
+    };
+    return isBuiltinStyle(style) ? messages[static_cast<std::size_t>(style)][static_cast<std::size_t>(kind)]
+                                 : std::string_view();
+}
+
+// A catalog snapshot is a FurnitureCatalog written once in a compact binary layout:
+//
+//     CatalogSnapshotHeader | CatalogSnapshotRecord[recordCount] | string pool[poolSize]
+//
+// Every record carries the style and kind tags and the offsets of its messages in the pool,
+// where each distinct message is stored once. The writer and the reader must agree on the
+// byte order, so a snapshot is only meant to be read on the machine that wrote it.
+struct CatalogSnapshotHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t recordCount;
+    std::uint32_t poolSize;
+    std::uint32_t reserved;
+};
+
+struct CatalogSnapshotRecord {
+    std::uint32_t sku;
+    std::uint8_t style;
+    std::uint8_t kind;
+    std::uint16_t reserved;
+    std::uint32_t messageOffset;
+    std::uint32_t messageLength;
+    std::uint32_t collaborationOffset;
+    std::uint32_t collaborationLength;
+};
+
+constexpr char catalogSnapshotMagic[8] = {'F', 'U', 'R', 'N', 'C', 'A', 'T', '\0'};
+constexpr std::uint32_t catalogSnapshotVersion = 1;
+static_assert(sizeof(CatalogSnapshotHeader) % alignof(CatalogSnapshotRecord) == 0, "records must stay aligned");
+
+// Writes the catalog as a snapshot to path. Returns false when the file cannot be written.
+bool writeCatalogSnapshot(const FurnitureCatalog& catalog, const char* path) {
+    struct Slice {
+        std::uint32_t offset;
+        std::uint32_t length;
+    };
+    std::string pool;
+    Slice messages[furnitureStyleCount][furnitureKindCount];
+    Slice collaborations[furnitureStyleCount][furnitureKindCount];
+    // A message already in the pool, even as part of a longer one, is not stored again
+    const auto intern = [&pool](std::string_view message) {
+        const std::size_t found = pool.find(message);
+        const Slice slice{static_cast<std::uint32_t>(found != std::string::npos ? found : pool.size()),
+                          static_cast<std::uint32_t>(message.size())};
+        if (found == std::string::npos) {
+            pool.append(message);
+        }
+        return slice;
+    };
+    for (std::size_t style = 0; style < furnitureStyleCount; ++style) {
+        for (std::size_t kind = 0; kind < furnitureKindCount; ++kind) {
+            messages[style][kind] = intern(productMessage(static_cast<FurnitureStyle>(style), static_cast<FurnitureKind>(kind)));
+            collaborations[style][kind] = intern(collaborationMessage(static_cast<FurnitureStyle>(style), static_cast<FurnitureKind>(kind)));
+        }
+    }
+
+    std::vector<CatalogSnapshotRecord> records;
+    records.reserve(catalog.size());
+    catalog.forEach([&](FurnitureStyle style, FurnitureKind kind, std::uint32_t sku) {
+        const Slice message = messages[static_cast<std::size_t>(style)][static_cast<std::size_t>(kind)];
+        const Slice collaboration = collaborations[static_cast<std::size_t>(style)][static_cast<std::size_t>(kind)];
+        records.push_back(CatalogSnapshotRecord{sku, static_cast<std::uint8_t>(style), static_cast<std::uint8_t>(kind), 0,
+                                                message.offset, message.length, collaboration.offset, collaboration.length});
+    });
+
+    CatalogSnapshotHeader header{};
+    std::memcpy(header.magic, catalogSnapshotMagic, sizeof(header.magic));
+    header.version = catalogSnapshotVersion;
+    header.recordCount = static_cast<std::uint32_t>(records.size());
+    header.poolSize = static_cast<std::uint32_t>(pool.size());
+
+    std::FILE* file = std::fopen(path, "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+    written = written && std::fwrite(records.data(), sizeof(CatalogSnapshotRecord), records.size(), file) == records.size();
+    written = written && std::fwrite(pool.data(), 1, pool.size(), file) == pool.size();
+    return std::fclose(file) == 0 && written;
+}
+
+// Read-only products over one record of a mapped snapshot. A view is two pointers,
+// so it is made on the stack on demand and nothing is copied out of the mapping.
+class MappedChair SEALED : public Chair {
+public:
+    MappedChair(const CatalogSnapshotRecord& record, const char* pool) : record_(&record), pool_(pool) { }
+    std::string sitOn() const override {
+        return std::string(sitOnView());
+    }
+    std::string_view sitOnView() const override {
+        return std::string_view(pool_ + record_->messageOffset, record_->messageLength);
+    }
+    FurnitureStyle style() const override {
+        return static_cast<FurnitureStyle>(record_->style);
+    }
+
+private:
+    const CatalogSnapshotRecord* record_;
+    const char* pool_;
+};
+
+class MappedSofa SEALED : public Sofa {
+public:
+    MappedSofa(const CatalogSnapshotRecord& record, const char* pool) : record_(&record), pool_(pool) { }
+    std::string layOn() const override {
+        return std::string(layOnView());
+    }
+    std::string putAside(const Chair& collaboratorChair) const override {
+        std::string result;
+        putAside(collaboratorChair, result);
+        return result;
+    }
+    std::string_view layOnView() const override {
+        return std::string_view(pool_ + record_->messageOffset, record_->messageLength);
+    }
+    // The snapshot stores only the prefix, so the message is always composed
+    std::string_view putAsideView(const Chair&) const override {
+        return {};
+    }
+    void putAside(const Chair& collaboratorChair, std::string& out) const override {
+        out.append(pool_ + record_->collaborationOffset, record_->collaborationLength);
+        out.append(collaboratorChair.sitOnView());
+    }
+    FurnitureStyle style() const override {
+        return static_cast<FurnitureStyle>(record_->style);
+    }
+
+private:
+    const CatalogSnapshotRecord* record_;
+    const char* pool_;
+};
+
+class MappedCoffeeTable SEALED : public CoffeeTable {
+public:
+    MappedCoffeeTable(const CatalogSnapshotRecord& record, const char* pool) : record_(&record), pool_(pool) { }
+    std::string coffeeOnMe() const override {
+        return std::string(coffeeOnMeView());
+    }
+    std::string sittingOn(const Sofa& collaboratorSofa) const override {
+        std::string result;
+        sittingOn(collaboratorSofa, result);
+        return result;
+    }
+    std::string_view coffeeOnMeView() const override {
+        return std::string_view(pool_ + record_->messageOffset, record_->messageLength);
+    }
+    // The snapshot stores only the suffix, so the message is always composed
+    std::string_view sittingOnView(const Sofa&) const override {
+        return {};
+    }
+    void sittingOn(const Sofa& collaboratorSofa, std::string& out) const override {
+        out.append(collaboratorSofa.layOnView());
+        out.append(pool_ + record_->collaborationOffset, record_->collaborationLength);
+    }
+    FurnitureStyle style() const override {
+        return static_cast<FurnitureStyle>(record_->style);
+    }
+
+private:
+    const CatalogSnapshotRecord* record_;
+    const char* pool_;
+};
+
+// A CatalogSnapshot maps a snapshot file read-only and hands out views over its records,
+// so opening a catalog costs a few page faults instead of one allocation per product.
+// Where mmap is not available the file is read into a single buffer instead.
+class CatalogSnapshot {
+public:
+    // Returns an empty optional when the file is missing, truncated or not a snapshot.
+    static std::optional<CatalogSnapshot> open(const char* path) {
+        CatalogSnapshot snapshot;
+#if __has_include(<sys/mman.h>)
+        const int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            return std::nullopt;
+        }
+        struct stat status;
+        if (::fstat(fd, &status) != 0 || status.st_size < static_cast<off_t>(sizeof(CatalogSnapshotHeader))) {
+            ::close(fd);
+            return std::nullopt;
+        }
+        void* mapping = ::mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            return std::nullopt;
+        }
+        snapshot.data_ = static_cast<const char*>(mapping);
+        snapshot.size_ = static_cast<std::size_t>(status.st_size);
+#else
+        std::FILE* file = std::fopen(path, "rb");
+        if (file == nullptr) {
+            return std::nullopt;
+        }
+        char chunk[4096];
+        std::size_t read;
+        while ((read = std::fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            snapshot.buffer_.insert(snapshot.buffer_.end(), chunk, chunk + read);
+        }
+        std::fclose(file);
+        snapshot.data_ = snapshot.buffer_.data();
+        snapshot.size_ = snapshot.buffer_.size();
+#endif
+        if (!snapshot.valid()) {
+            return std::nullopt;
+        }
+        return snapshot;
+    }
+
+    CatalogSnapshot(CatalogSnapshot&& other) noexcept
+        : data_(std::exchange(other.data_, nullptr)), size_(std::exchange(other.size_, 0)) {
+#if !__has_include(<sys/mman.h>)
+        buffer_ = std::move(other.buffer_);
+#endif
+    }
+    CatalogSnapshot& operator=(CatalogSnapshot&&) = delete;
+    ~CatalogSnapshot() {
+#if __has_include(<sys/mman.h>)
+        if (data_ != nullptr) {
+            ::munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    std::size_t size() const {
+        return header().recordCount;
+    }
+    FurnitureStyle style(std::size_t i) const {
+        return static_cast<FurnitureStyle>(records()[i].style);
+    }
+    FurnitureKind kind(std::size_t i) const {
+        return static_cast<FurnitureKind>(records()[i].kind);
+    }
+    std::uint32_t sku(std::size_t i) const {
+        return records()[i].sku;
+    }
+    // The view of item i, which must be of the matching kind
+    MappedChair chair(std::size_t i) const {
+        return MappedChair(records()[i], pool());
+    }
+    MappedSofa sofa(std::size_t i) const {
+        return MappedSofa(records()[i], pool());
+    }
+    MappedCoffeeTable coffeeTable(std::size_t i) const {
+        return MappedCoffeeTable(records()[i], pool());
+    }
+
+    // Appends the sitOn/layOn/coffeeOnMe message of every item to out, like FurnitureCatalog::render.
+    void render(std::string& out) const {
+        std::size_t length = 0;
+        for (std::size_t i = 0; i < size(); ++i) {
+            length += records()[i].messageLength;
+        }
+        out.reserve(out.size() + length);
+        for (std::size_t i = 0; i < size(); ++i) {
+            out.append(pool() + records()[i].messageOffset, records()[i].messageLength);
+        }
+    }
+
+private:
+    CatalogSnapshot() = default;
+
+    const CatalogSnapshotHeader& header() const {
+        return *reinterpret_cast<const CatalogSnapshotHeader*>(data_);
+    }
+    const CatalogSnapshotRecord* records() const {
+        return reinterpret_cast<const CatalogSnapshotRecord*>(data_ + sizeof(CatalogSnapshotHeader));
+    }
+    const char* pool() const {
+        return data_ + sizeof(CatalogSnapshotHeader) + header().recordCount * sizeof(CatalogSnapshotRecord);
+    }
+
+    // Checks the header and that every record is of a built-in style and kind with its messages inside the pool
+    bool valid() const {
+        if (size_ < sizeof(CatalogSnapshotHeader) ||
+            std::memcmp(header().magic, catalogSnapshotMagic, sizeof(catalogSnapshotMagic)) != 0 ||
+            header().version != catalogSnapshotVersion) {
+            return false;
+        }
+        const std::size_t poolOffset = sizeof(CatalogSnapshotHeader) + std::size_t{header().recordCount} * sizeof(CatalogSnapshotRecord);
+        if (poolOffset > size_ || size_ - poolOffset != header().poolSize) {
+            return false;
+        }
+        const std::uint64_t poolSize = header().poolSize;
+        for (std::size_t i = 0; i < size(); ++i) {
+            const CatalogSnapshotRecord& record = records()[i];
+            if (record.style >= furnitureStyleCount || record.kind >= furnitureKindCount ||
+                std::uint64_t{record.messageOffset} + record.messageLength > poolSize ||
+                std::uint64_t{record.collaborationOffset} + record.collaborationLength > poolSize) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+#if !__has_include(<sys/mman.h>)
+    std::vector<char> buffer_;
+#endif
+};
+
+// A FurnitureArena places products one after another into a single block of
+// memory supplied by the caller, so creating a whole furniture set costs no
+// calls to the global heap. Everything is released at once by reset().
+// The concrete products own no resources, so the arena does not run their
+// destructors: reset() simply rewinds to the beginning of the block.
+class FurnitureArena {
+public:
+    FurnitureArena(void* buffer, std::size_t size)
+        : buffer_(static_cast<unsigned char*>(buffer)), size_(size), used_(0) { }
+    FurnitureArena(const FurnitureArena&) = delete;
+    FurnitureArena& operator=(const FurnitureArena&) = delete;
+
+    template <typename Product, typename... Args>
+    Product* create(Args&&... args) {
+        void* place = buffer_ + used_;
+        std::size_t space = size_ - used_;
+        if (!std::align(alignof(Product), sizeof(Product), place, space)) {
+            throw std::bad_alloc();
+        }
+        used_ = size_ - space + sizeof(Product);
+        return new (place) Product(std::forward<Args>(args)...);
+    }
+    void reset() { used_ = 0; }
+    std::size_t used() const { return used_; }
+    std::size_t capacity() const { return size_; }
+
+private:
+    unsigned char* buffer_;
+    std::size_t size_;
+    std::size_t used_;
+};
+
+// InlinePoly keeps one object of any class derived from Base in a buffer of N bytes
+// inside itself and hands it out through the Base interface, like the small buffer
+// of std::function. The concrete products are tiny, so a whole set held this way
+// stays on the stack and still goes through the Chair/Sofa/CoffeeTable interfaces.
+template <typename Base, std::size_t N>
+class InlinePoly {
+public:
+    InlinePoly() { }
+    InlinePoly(const InlinePoly&) = delete;
+    InlinePoly& operator=(const InlinePoly&) = delete;
+    ~InlinePoly() { reset(); }
+
+    template <typename Concrete, typename... Args>
+    Concrete& emplace(Args&&... args) {
+        static_assert(std::is_base_of<Base, Concrete>::value, "InlinePoly only holds classes derived from Base");
+        static_assert(sizeof(Concrete) <= N, "the product does not fit into the InlinePoly buffer");
+        static_assert(alignof(Concrete) <= alignof(std::max_align_t), "the product is over-aligned");
+        reset();
+        Concrete* product = new (storage_) Concrete(std::forward<Args>(args)...);
+        product_ = product;
+        return *product;
+    }
+    void reset() {
+        if (product_ != nullptr) {
+            product_->~Base();
+            product_ = nullptr;
+        }
+    }
+    Base* get() const { return product_; }
+    Base& operator*() const { return *product_; }
+    Base* operator->() const { return product_; }
+    explicit operator bool() const { return product_ != nullptr; }
+
+private:
+    alignas(std::max_align_t) unsigned char storage_[N];
+    Base* product_ = nullptr;
+};
+
+constexpr std::size_t inlineProductSize = 2 * sizeof(void*);
+using InlineChair = InlinePoly<Chair, inlineProductSize>;
+using InlineSofa = InlinePoly<Sofa, inlineProductSize>;
+using InlineCoffeeTable = InlinePoly<CoffeeTable, inlineProductSize>;
+
+// A per-thread free list of blocks that fit any product. Every thread takes blocks from
+// and returns blocks to a list of its own, so recycling products touches no shared allocator
+// state and no cache line of another thread. A block freed on another thread than the one
+// that took it joins the list of the freeing thread. Spare blocks beyond maxSpare go back
+// to the heap. Per NUMA node placement is left to the OS, which first-touch allocates
+// a block on the node of the thread that took it first.
+class ThreadProductPool {
+public:
+    static constexpr std::size_t blockSize = inlineProductSize;
+    static constexpr std::size_t maxSpare = 64;
+
+    static void* acquire() {
+        Blocks& spare = local();
+        if (spare.head == nullptr) {
+            return new Block;
+        }
+        Block* block = spare.head;
+        spare.head = block->next;
+        --spare.count;
+        return block;
+    }
+    static void release(void* memory) {
+        Blocks& spare = local();
+        Block* block = static_cast<Block*>(memory);
+        if (spare.count == maxSpare) {
+            delete block;
+            return;
+        }
+        block->next = spare.head;
+        spare.head = block;
+        ++spare.count;
+    }
+
+private:
+    union alignas(std::max_align_t) Block {
+        Block* next;
+        unsigned char bytes[blockSize];
+    };
+    struct Blocks {
+        Block* head = nullptr;
+        std::size_t count = 0;
+        ~Blocks() {
+            while (head != nullptr) {
+                delete std::exchange(head, head->next);
+            }
+        }
+    };
+    static Blocks& local() {
+        thread_local Blocks spare;
+        return spare;
+    }
+};
+
+// Deleter matched to where a product was created: heap products are deleted, while
+// arena products are only destroyed and their storage comes back when the arena is reset.
+// Products from a ThreadProductPool are destroyed and their block goes back to the pool.
+// An arena must outlive every ProductPtr into it.
+struct ProductDeleter {
+    bool inArena = false;
+    bool inThreadPool = false;
+    template <typename Product>
+    void operator()(Product* product) const {
+        if (inThreadPool) {
+            product->~Product();
+            ThreadProductPool::release(product);
+        } else if (inArena) {
+            product->~Product();
+        } else {
+            delete product;
+        }
+    }
+};
+template <typename Product>
+using ProductPtr = std::unique_ptr<Product, ProductDeleter>;
+
+// Abstract Factory interface declares a set of methods that return different abstract products
+class FurnitureFactory {
+public:
+    FurnitureFactory() { }
+    FurnitureFactory(const FurnitureFactory&) = delete;
+    FurnitureFactory& operator=(const FurnitureFactory&) = delete;
+    virtual ~FurnitureFactory() {
+        delete sharedChair_.load();
+        delete sharedSofa_.load();
+        delete sharedCoffeeTable_.load();
+    }
+    virtual Chair* createChair() const = 0;
+    virtual Sofa* createSofa() const = 0;
+    virtual CoffeeTable* createCoffeeTable() const = 0;
+    // Same products, constructed into the arena instead of the heap.
+    // They must not be deleted, the owner of the arena resets it instead.
+    virtual Chair* createChair(FurnitureArena& arena) const = 0;
+    virtual Sofa* createSofa(FurnitureArena& arena) const = 0;
+    virtual CoffeeTable* createCoffeeTable(FurnitureArena& arena) const = 0;
+    // Same products, constructed into the holder, which owns them from then on
+    virtual Chair& createChair(InlineChair& holder) const = 0;
+    virtual Sofa& createSofa(InlineSofa& holder) const = 0;
+    virtual CoffeeTable& createCoffeeTable(InlineCoffeeTable& holder) const = 0;
+    // Owning versions of the create methods, safe to use with exceptions
+    ProductPtr<Chair> makeChair() const {
+        return ProductPtr<Chair>(createChair());
+    }
+    ProductPtr<Sofa> makeSofa() const {
+        return ProductPtr<Sofa>(createSofa());
+    }
+    ProductPtr<CoffeeTable> makeCoffeeTable() const {
+        return ProductPtr<CoffeeTable>(createCoffeeTable());
+    }
+    ProductPtr<Chair> makeChair(FurnitureArena& arena) const {
+        return ProductPtr<Chair>(createChair(arena), ProductDeleter{true});
+    }
+    ProductPtr<Sofa> makeSofa(FurnitureArena& arena) const {
+        return ProductPtr<Sofa>(createSofa(arena), ProductDeleter{true});
+    }
+    ProductPtr<CoffeeTable> makeCoffeeTable(FurnitureArena& arena) const {
+        return ProductPtr<CoffeeTable>(createCoffeeTable(arena), ProductDeleter{true});
+    }
+    // Same products, in blocks of the ThreadProductPool of the calling thread
+    ProductPtr<Chair> makeLocalChair() const {
+        return makeLocal<Chair>([this](FurnitureArena& arena) { return createChair(arena); });
+    }
+    ProductPtr<Sofa> makeLocalSofa() const {
+        return makeLocal<Sofa>([this](FurnitureArena& arena) { return createSofa(arena); });
+    }
+    ProductPtr<CoffeeTable> makeLocalCoffeeTable() const {
+        return makeLocal<CoffeeTable>([this](FurnitureArena& arena) { return createCoffeeTable(arena); });
+    }
+    // Creates count matching sets with a single call
+    virtual FurnitureSetBatch createSets(std::size_t count) const = 0;
+    // Canonical instances shared by every caller of this factory. The products are immutable,
+    // so each one is created once with the factory method and published with a single
+    // compare-exchange: callers never lock and, after the first call, never allocate.
+    const Chair& sharedChair() const {
+        return publishOnce(sharedChair_, [this] { return createChair(); });
+    }
+    const Sofa& sharedSofa() const {
+        return publishOnce(sharedSofa_, [this] { return createSofa(); });
+    }
+    const CoffeeTable& sharedCoffeeTable() const {
+        return publishOnce(sharedCoffeeTable_, [this] { return createCoffeeTable(); });
+    }
+
+private:
+    // A pool block seen as an arena for a single product
+    template <typename Product, typename Create>
+    static ProductPtr<Product> makeLocal(Create create) {
+        void* block = ThreadProductPool::acquire();
+        FurnitureArena arena(block, ThreadProductPool::blockSize);
+        try {
+            return ProductPtr<Product>(create(arena), ProductDeleter{false, true});
+        } catch (...) {
+            ThreadProductPool::release(block);
+            throw;
+        }
+    }
+
+    // If two threads race to create the product, the loser deletes its copy
+    template <typename Product, typename Create>
+    static const Product& publishOnce(std::atomic<Product*>& slot, Create create) {
+        Product* product = slot.load(std::memory_order_acquire);
+        if (product == nullptr) {
+            Product* created = create();
+            if (slot.compare_exchange_strong(product, created, std::memory_order_acq_rel,
+                                             std::memory_order_acquire)) {
+                product = created;
+            } else {
+                delete created;
+            }
+        }
+        return *product;
+    }
+
+    mutable std::atomic<Chair*> sharedChair_ {nullptr};
+    mutable std::atomic<Sofa*> sharedSofa_ {nullptr};
+    mutable std::atomic<CoffeeTable*> sharedCoffeeTable_ {nullptr};
+};
+
+// Concrete Factories produce a family of products that belong to a single variant!
+// The factory guarantees that resulting products are compatible. Note
+// that signatures of the Concrete Factory's methods return an abstract product,
+// while inside the method a concrete product is instantiated.
+class ModernFurnitureFactory SEALED : public FurnitureFactory {
+public:
+    Chair* createChair() const override {
+        FURNITURE_PROBE(Modern, CreateChair);
+        return new ModernChair;
+    }
+    Sofa* createSofa() const override {
+        FURNITURE_PROBE(Modern, CreateSofa);
+        return new ModernSofa;
+    }
+    CoffeeTable* createCoffeeTable() const override {
+        FURNITURE_PROBE(Modern, CreateCoffeeTable);
+        return new ModernCoffeeTable;
+    }
+    Chair* createChair(FurnitureArena& arena) const override {
+        FURNITURE_PROBE(Modern, CreateChair);
+        return arena.create<ModernChair>();
+    }
+    Sofa* createSofa(FurnitureArena& arena) const override {
+        FURNITURE_PROBE(Modern, CreateSofa);
+        return arena.create<ModernSofa>();
+    }
+    CoffeeTable* createCoffeeTable(FurnitureArena& arena) const override {
+        FURNITURE_PROBE(Modern, CreateCoffeeTable);
+        return arena.create<ModernCoffeeTable>();
+    }
+    Chair& createChair(InlineChair& holder) const override {
+        FURNITURE_PROBE(Modern, CreateChair);
+        return holder.emplace<ModernChair>();
+    }
+    Sofa& createSofa(InlineSofa& holder) const override {
+        FURNITURE_PROBE(Modern, CreateSofa);
+        return holder.emplace<ModernSofa>();
+    }
+    CoffeeTable& createCoffeeTable(InlineCoffeeTable& holder) const override {
+        FURNITURE_PROBE(Modern, CreateCoffeeTable);
+        return holder.emplace<ModernCoffeeTable>();
+    }
+    FurnitureSetBatch createSets(std::size_t count) const override {
+        return FurnitureSetBatch::create<FurnitureStyle::Modern>(count);
+    }
+};
+
+class VictorianFurnitureFactory SEALED : public FurnitureFactory {
+public:
+    Chair* createChair() const override {
+        FURNITURE_PROBE(Victorian, CreateChair);
+        return new VictorianChair;
+    }
+    Sofa* createSofa() const override {
+        FURNITURE_PROBE(Victorian, CreateSofa);
+        return new VictorianSofa;
+    }
+    CoffeeTable* createCoffeeTable() const override {
+        FURNITURE_PROBE(Victorian, CreateCoffeeTable);
+        return new VictorianCoffeeTable;
+    }
+    Chair* createChair(FurnitureArena& arena) const override {
+        FURNITURE_PROBE(Victorian, CreateChair);
+        return arena.create<VictorianChair>();
+    }
+    Sofa* createSofa(FurnitureArena& arena) const override {
+        FURNITURE_PROBE(Victorian, CreateSofa);
+        return arena.create<VictorianSofa>();
+    }
+    CoffeeTable* createCoffeeTable(FurnitureArena& arena) const override {
+        FURNITURE_PROBE(Victorian, CreateCoffeeTable);
+        return arena.create<VictorianCoffeeTable>();
+    }
+    Chair& createChair(InlineChair& holder) const override {
+        FURNITURE_PROBE(Victorian, CreateChair);
+        return holder.emplace<VictorianChair>();
+    }
+    Sofa& createSofa(InlineSofa& holder) const override {
+        FURNITURE_PROBE(Victorian, CreateSofa);
+        return holder.emplace<VictorianSofa>();
+    }
+    CoffeeTable& createCoffeeTable(InlineCoffeeTable& holder) const override {
+        FURNITURE_PROBE(Victorian, CreateCoffeeTable);
+        return holder.emplace<VictorianCoffeeTable>();
+    }
+    FurnitureSetBatch createSets(std::size_t count) const override {
+        return FurnitureSetBatch::create<FurnitureStyle::Victorian>(count);
+    }
+};
+
+class ArtDecoFurnitureFactory SEALED : public FurnitureFactory {
+public:
+    Chair* createChair() const override {
+        FURNITURE_PROBE(ArtDeco, CreateChair);
+        return new ArtDecoChair;
+    }
+    Sofa* createSofa() const override {
+        FURNITURE_PROBE(ArtDeco, CreateSofa);
+        return new ArtDecoSofa;
+    }
+    CoffeeTable* createCoffeeTable() const override {
+        FURNITURE_PROBE(ArtDeco, CreateCoffeeTable);
+        return new ArtDecoCoffeeTable;
+    }
+    Chair* createChair(FurnitureArena& arena) const override {
+        FURNITURE_PROBE(ArtDeco, CreateChair);
+        return arena.create<ArtDecoChair>();
+    }
+    Sofa* createSofa(FurnitureArena& arena) const override {
+        FURNITURE_PROBE(ArtDeco, CreateSofa);
+        return arena.create<ArtDecoSofa>();
+    }
+    CoffeeTable* createCoffeeTable(FurnitureArena& arena) const override {
+        FURNITURE_PROBE(ArtDeco, CreateCoffeeTable);
+        return arena.create<ArtDecoCoffeeTable>();
+    }
+    Chair& createChair(InlineChair& holder) const override {
+        FURNITURE_PROBE(ArtDeco, CreateChair);
+        return holder.emplace<ArtDecoChair>();
+    }
+    Sofa& createSofa(InlineSofa& holder) const override {
+        FURNITURE_PROBE(ArtDeco, CreateSofa);
+        return holder.emplace<ArtDecoSofa>();
+    }
+    CoffeeTable& createCoffeeTable(InlineCoffeeTable& holder) const override {
+        FURNITURE_PROBE(ArtDeco, CreateCoffeeTable);
+        return holder.emplace<ArtDecoCoffeeTable>();
+    }
+    FurnitureSetBatch createSets(std::size_t count) const override {
+        return FurnitureSetBatch::create<FurnitureStyle::ArtDeco>(count);
+    }
+};
+
+// Compares a request string against a lowercase style name
+bool equalsIgnoreCase(std::string_view lowercase, std::string_view name) {
+    if (lowercase.size() != name.size()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < name.size(); ++i) {
+        const char c = name[i] >= 'A' && name[i] <= 'Z' ? static_cast<char>(name[i] - 'A' + 'a') : name[i];
+        if (c != lowercase[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The registry resolves a style, or its name taken from a request, to a shared, immutable
+// factory, so picking the factory per request is a single lookup with no allocation.
+// The names of the built-in styles have distinct lengths, which makes "length modulo 4"
+// a perfect hash: it selects the only candidate slot, and one case-insensitive
+// comparison confirms the match.
+class FurnitureFactoryRegistry {
+public:
+    // Styles defined at run time have no shared factory here: get() and local() throw
+    // std::invalid_argument for them, DataDrivenFurnitureFactory serves them instead.
+    static const FurnitureFactory& get(FurnitureStyle style) {
+        static const ModernFurnitureFactory modern {};
+        static const VictorianFurnitureFactory victorian {};
+        static const ArtDecoFurnitureFactory artDeco {};
+        static const FurnitureFactory* const factories[furnitureStyleCount] = {&modern, &victorian, &artDeco};
+        requireBuiltinStyle(style);
+        return *factories[static_cast<std::size_t>(style)];
+    }
+    // Same as get(), but every thread has factories of its own, so the shared products
+    // of each thread's factories live in memory only that thread touches
+    static const FurnitureFactory& local(FurnitureStyle style) {
+        thread_local const ModernFurnitureFactory modern {};
+        thread_local const VictorianFurnitureFactory victorian {};
+        thread_local const ArtDecoFurnitureFactory artDeco {};
+        const FurnitureFactory* const factories[furnitureStyleCount] = {&modern, &victorian, &artDeco};
+        requireBuiltinStyle(style);
+        return *factories[static_cast<std::size_t>(style)];
+    }
+    static std::optional<FurnitureStyle> findStyle(std::string_view name) {
+        const Entry& entry = table[name.size() % tableSize];
+        if (entry.name.empty() || !equalsIgnoreCase(entry.name, name)) {
+            return std::nullopt;
+        }
+        return entry.style;
+    }
+    // nullptr when the name is not a known style
+    static const FurnitureFactory* find(std::string_view name) {
+        const std::optional<FurnitureStyle> style = findStyle(name);
+        return style ? &get(*style) : nullptr;
+    }
+
+private:
+    struct Entry {
+        std::string_view name;
+        FurnitureStyle style;
+    };
+    static constexpr std::size_t tableSize = 4;
+    static constexpr Entry table[tableSize] = {
+        {"", FurnitureStyle::Modern},
+        {"victorian", FurnitureStyle::Victorian},
+        {"modern", FurnitureStyle::Modern},
+        {"artdeco", FurnitureStyle::ArtDeco},
+    };
+
+public:
+    // Every name must sit in the slot its hash points to
+    static constexpr bool isPerfectHash() {
+        for (std::size_t slot = 0; slot < tableSize; ++slot) {
+            if (!table[slot].name.empty() && table[slot].name.size() % tableSize != slot) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+static_assert(FurnitureFactoryRegistry::isPerfectHash(), "built-in style names must hash to their own slots");
+
+// A factory as plain data: a table of construction functions that fits one cache line.
+// The tables of the built-in styles are constexpr, indexed by style and copied by value,
+// so they can be handed to batch builders without allocating any factory object.
+struct alignas(64) FurnitureFactoryTable {
+    FurnitureStyle style;
+    Chair* (*createChair)();
+    Sofa* (*createSofa)();
+    CoffeeTable* (*createCoffeeTable)();
+    Chair* (*createChairInArena)(FurnitureArena& arena);
+    Sofa* (*createSofaInArena)(FurnitureArena& arena);
+    CoffeeTable* (*createCoffeeTableInArena)(FurnitureArena& arena);
+    FurnitureSetBatch (*createSets)(std::size_t count);
+};
+static_assert(sizeof(FurnitureFactoryTable) <= 64, "a factory table must fit into one cache line");
+
+template <FurnitureStyle Style, FurnitureKind Kind, typename Base, typename Product>
+Base* constructOnHeap() {
+    FURNITURE_COUNT_CREATED(Style, Kind, 1);
+    return new Product;
+}
+
+template <FurnitureStyle Style, FurnitureKind Kind, typename Base, typename Product>
+Base* constructInArena(FurnitureArena& arena) {
+    FURNITURE_COUNT_CREATED(Style, Kind, 1);
+    return arena.create<Product>();
+}
+
+template <FurnitureStyle Style>
+constexpr FurnitureFactoryTable makeFurnitureFactoryTable() {
+    using Traits = FurnitureTraits<Style>;
+    return FurnitureFactoryTable{
+        Style,
+        &constructOnHeap<Style, FurnitureKind::Chair, Chair, typename Traits::ChairType>,
+        &constructOnHeap<Style, FurnitureKind::Sofa, Sofa, typename Traits::SofaType>,
+        &constructOnHeap<Style, FurnitureKind::CoffeeTable, CoffeeTable, typename Traits::CoffeeTableType>,
+        &constructInArena<Style, FurnitureKind::Chair, Chair, typename Traits::ChairType>,
+        &constructInArena<Style, FurnitureKind::Sofa, Sofa, typename Traits::SofaType>,
+        &constructInArena<Style, FurnitureKind::CoffeeTable, CoffeeTable, typename Traits::CoffeeTableType>,
+        &FurnitureSetBatch::create<Style>,
+    };
+}
+
+constexpr FurnitureFactoryTable furnitureFactoryTables[furnitureStyleCount] = {
+    makeFurnitureFactoryTable<FurnitureStyle::Modern>(),
+    makeFurnitureFactoryTable<FurnitureStyle::Victorian>(),
+    makeFurnitureFactoryTable<FurnitureStyle::ArtDeco>(),
+};
+
+// Throws std::invalid_argument for a style defined at run time, which has no table
+constexpr const FurnitureFactoryTable& furnitureFactoryTable(FurnitureStyle style) {
+    requireBuiltinStyle(style);
+    return furnitureFactoryTables[static_cast<std::size_t>(style)];
+}
+
+// Builds one batch per requested style, each with a single call through its table
+std::vector<FurnitureSetBatch> buildSets(std::span<const FurnitureFactoryTable> tables, std::size_t setsPerStyle) {
+    std::vector<FurnitureSetBatch> batches;
+    batches.reserve(tables.size());
+    for (const FurnitureFactoryTable table : tables) {
+        batches.push_back(table.createSets(setsPerStyle));
+    }
+    return batches;
+}
+
+// A FurnitureStyleTable loads styles from a configuration and compiles them into one
+// flat array of DataDrivenStyle entries over a single message pool. Every style gets
+// the next free id after the built-in ones, so from an id to its messages is one index.
+// The configuration has a section per style and one key per product message:
+//
+//     # comment
+//     [Rustic]
+//     sitOn = You can sit on RUSTIC chair\n
+//     layOn = You can lie on RUSTIC Sofa\n
+//     putAside = "Now you can lie on Rustic sofa and "
+//     coffeeOnMe = You're enjoying a cup of coffee on Rustic Coffee Table\n
+//     sittingOn = Enjoy your coffee on Rustic Coffee Table\n
+//
+// Values may be quoted to keep surrounding spaces, and \n, \" and \\ are unescaped.
+// The table owns the pool its entries point into, so it can be neither copied nor moved.
+class FurnitureStyleTable {
+public:
+    static constexpr std::size_t maxStyles = 256 - furnitureStyleCount;
+
+    // Throws std::invalid_argument naming the line of the first error in config
+    explicit FurnitureStyleTable(std::string_view config) {
+        std::vector<Definition> definitions = parse(config);
+        std::size_t poolSize = 0;
+        for (const Definition& definition : definitions) {
+            poolSize += definition.name.size() + definition.values[putAsideKey].size() +
+                        definition.values[sitOnKey].size() + definition.values[layOnKey].size() +
+                        definition.values[coffeeOnMeKey].size() + definition.values[sittingOnKey].size();
+        }
+        // Each style is laid out as name | putAside sitOn | coffeeOnMe | layOn sittingOn,
+        // so every message is a slice of the joined ones. The pool never grows after reserve,
+        // which keeps the slices valid.
+        pool_.reserve(poolSize);
+        styles_.reserve(definitions.size());
+        for (const Definition& definition : definitions) {
+            DataDrivenStyle style;
+            style.id = static_cast<FurnitureStyle>(furnitureStyleCount + styles_.size());
+            const std::size_t name = append(definition.name);
+            const std::size_t putAsideWithChair = append(definition.values[putAsideKey]);
+            append(definition.values[sitOnKey]);
+            const std::size_t coffeeOnMe = append(definition.values[coffeeOnMeKey]);
+            const std::size_t sittingOnWithSofa = append(definition.values[layOnKey]);
+            append(definition.values[sittingOnKey]);
+
+            const std::string_view pool(pool_.data(), pool_.size());
+            style.name = pool.substr(name, definition.name.size());
+            style.putAsideWithChair = pool.substr(putAsideWithChair, definition.values[putAsideKey].size() +
+                                                                         definition.values[sitOnKey].size());
+            style.putAside = style.putAsideWithChair.substr(0, definition.values[putAsideKey].size());
+            style.sitOn = style.putAsideWithChair.substr(style.putAside.size());
+            style.coffeeOnMe = pool.substr(coffeeOnMe, definition.values[coffeeOnMeKey].size());
+            style.sittingOnWithSofa = pool.substr(sittingOnWithSofa, definition.values[layOnKey].size() +
+                                                                         definition.values[sittingOnKey].size());
+            style.layOn = style.sittingOnWithSofa.substr(0, definition.values[layOnKey].size());
+            style.sittingOn = style.sittingOnWithSofa.substr(style.layOn.size());
+            styles_.push_back(style);
+        }
+    }
+    FurnitureStyleTable(const FurnitureStyleTable&) = delete;
+    FurnitureStyleTable& operator=(const FurnitureStyleTable&) = delete;
+
+    std::size_t size() const { return styles_.size(); }
+    const std::vector<DataDrivenStyle>& styles() const { return styles_; }
+    // nullptr when the id is built in or was not given out by this table
+    const DataDrivenStyle* get(FurnitureStyle id) const {
+        const std::size_t index = static_cast<std::size_t>(id) - furnitureStyleCount;
+        return !isBuiltinStyle(id) && index < styles_.size() ? &styles_[index] : nullptr;
+    }
+    // Case-insensitive like FurnitureFactoryRegistry::find; nullptr when no style has that name
+    const DataDrivenStyle* find(std::string_view name) const {
+        for (const DataDrivenStyle& style : styles_) {
+            if (equalsIgnoreCase(style.name, name)) {
+                return &style;
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    enum Key : std::size_t { sitOnKey, layOnKey, putAsideKey, coffeeOnMeKey, sittingOnKey, keyCount };
+    static constexpr std::string_view keyNames[keyCount] = {"sitOn", "layOn", "putAside", "coffeeOnMe", "sittingOn"};
+
+    // Names are kept lowercase, values unescaped
+    struct Definition {
+        std::string name;
+        std::string values[keyCount];
+        bool defined[keyCount] = {};
+    };
+
+    std::size_t append(std::string_view text) {
+        const std::size_t offset = pool_.size();
+        pool_.append(text);
+        return offset;
+    }
+
+    [[noreturn]] static void fail(std::size_t line, const std::string& message) {
+        throw std::invalid_argument("style configuration line " + std::to_string(line) + ": " + message);
+    }
+
+    static std::string_view trim(std::string_view text) {
+        const std::size_t begin = text.find_first_not_of(" \t\r");
+        if (begin == std::string_view::npos) {
+            return {};
+        }
+        return text.substr(begin, text.find_last_not_of(" \t\r") - begin + 1);
+    }
+
+    static std::string unescape(std::string_view value, std::size_t line) {
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+            value = value.substr(1, value.size() - 2);
+        }
+        std::string result;
+        result.reserve(value.size());
+        for (std::size_t i = 0; i < value.size(); ++i) {
+            if (value[i] != '\\') {
+                result.push_back(value[i]);
+                continue;
+            }
+            if (++i == value.size()) {
+                fail(line, "dangling escape");
+            }
+            switch (value[i]) {
+            case 'n': result.push_back('\n'); break;
+            case '"': result.push_back('"'); break;
+            case '\\': result.push_back('\\'); break;
+            default: fail(line, std::string("unknown escape \\") + value[i]);
+            }
+        }
+        return result;
+    }
+
+    static void checkComplete(const Definition& definition, std::size_t line) {
+        for (std::size_t key = 0; key < keyCount; ++key) {
+            if (!definition.defined[key]) {
+                fail(line, "style \"" + definition.name + "\" has no " + std::string(keyNames[key]));
+            }
+        }
+    }
+
+    static std::vector<Definition> parse(std::string_view config) {
+        std::vector<Definition> definitions;
+        std::size_t line = 0;
+        std::size_t sectionLine = 0;
+        while (!config.empty()) {
+            ++line;
+            const std::size_t end = config.find('\n');
+            const std::string_view text = trim(config.substr(0, end));
+            config = end == std::string_view::npos ? std::string_view() : config.substr(end + 1);
+            if (text.empty() || text.front() == '#' || text.front() == ';') {
+                continue;
+            }
+            if (text.front() == '[') {
+                if (text.back() != ']' || trim(text.substr(1, text.size() - 2)).empty()) {
+                    fail(line, "malformed section header");
+                }
+                if (!definitions.empty()) {
+                    checkComplete(definitions.back(), sectionLine);
+                }
+                if (definitions.size() == maxStyles) {
+                    fail(line, "too many styles");
+                }
+                Definition definition;
+                for (const char c : trim(text.substr(1, text.size() - 2))) {
+                    definition.name.push_back(c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c);
+                }
+                if (FurnitureFactoryRegistry::findStyle(definition.name)) {
+                    fail(line, "style \"" + definition.name + "\" is built in");
+                }
+                for (const Definition& defined : definitions) {
+                    if (defined.name == definition.name) {
+                        fail(line, "style \"" + definition.name + "\" is defined twice");
+                    }
+                }
+                definitions.push_back(std::move(definition));
+                sectionLine = line;
+                continue;
+            }
+            const std::size_t equals = text.find('=');
+            if (equals == std::string_view::npos) {
+                fail(line, "expected key = value");
+            }
+            if (definitions.empty()) {
+                fail(line, "key outside of a [style] section");
+            }
+            const std::string_view key = trim(text.substr(0, equals));
+            const std::size_t index = static_cast<std::size_t>(
+                std::find(std::begin(keyNames), std::end(keyNames), key) - std::begin(keyNames));
+            if (index == keyCount) {
+                fail(line, "unknown key \"" + std::string(key) + "\"");
+            }
+            Definition& definition = definitions.back();
+            definition.values[index] = unescape(trim(text.substr(equals + 1)), line);
+            definition.defined[index] = true;
+        }
+        if (!definitions.empty()) {
+            checkComplete(definitions.back(), sectionLine);
+        }
+        return definitions;
+    }
+
+    std::string pool_;
+    std::vector<DataDrivenStyle> styles_;
+};
+
+// A factory for any style of a FurnitureStyleTable. The style is resolved once, when the
+// factory is made, so every call afterwards reads the messages straight from the entry.
+// The table must outlive the factory and the products it makes.
+class DataDrivenFurnitureFactory SEALED : public FurnitureFactory {
+public:
+    explicit DataDrivenFurnitureFactory(const DataDrivenStyle& style) : style_(style) { }
+    Chair* createChair() const override {
+        return new DataDrivenChair(style_);
+    }
+    Sofa* createSofa() const override {
+        return new DataDrivenSofa(style_);
+    }
+    CoffeeTable* createCoffeeTable() const override {
+        return new DataDrivenCoffeeTable(style_);
+    }
+    Chair* createChair(FurnitureArena& arena) const override {
+        return arena.create<DataDrivenChair>(style_);
+    }
+    Sofa* createSofa(FurnitureArena& arena) const override {
+        return arena.create<DataDrivenSofa>(style_);
+    }
+    CoffeeTable* createCoffeeTable(FurnitureArena& arena) const override {
+        return arena.create<DataDrivenCoffeeTable>(style_);
+    }
+    Chair& createChair(InlineChair& holder) const override {
+        return holder.emplace<DataDrivenChair>(style_);
+    }
+    Sofa& createSofa(InlineSofa& holder) const override {
+        return holder.emplace<DataDrivenSofa>(style_);
+    }
+    CoffeeTable& createCoffeeTable(InlineCoffeeTable& holder) const override {
+        return holder.emplace<DataDrivenCoffeeTable>(style_);
+    }
+    FurnitureSetBatch createSets(std::size_t count) const override {
+        return FurnitureSetBatch::create(style_, count);
+    }
+    const DataDrivenStyle& style() const { return style_; }
+
+private:
+    const DataDrivenStyle& style_;
+};
+
+// A style shipped as configuration, used by the demo and the benchmarks
+constexpr std::string_view rusticStyleConfig = R"(# Rustic collection
+[Rustic]
+sitOn = You can sit on RUSTIC chair\n
+layOn = You can lie on RUSTIC Sofa\n
+putAside = "Now you can lie on Rustic sofa and "
+coffeeOnMe = You're enjoying a cup of coffee on Rustic Coffee Table\n
+sittingOn = Enjoy your coffee on Rustic Coffee Table\n
+)";
+
+// A FurnitureFactoryHandle lets the default factory be swapped under live traffic.
+// Readers pin the current factory with a Guard and dispatch through it, wait-free:
+// entering announces the current epoch in the reader's own slot, loads the factory pointer
+// and leaving clears the slot, with no loop and no lock. A writer exchanges the pointer,
+// advances the epoch and waits until every slot is either clear or announces the new epoch;
+// from then on no reader can still hold the old factory, and it is destroyed if the handle
+// owns it. Writers are serialized and only writers ever wait.
+//
+// A thread takes a reader slot on its first read and gives it back when it exits. Slots come
+// in chunks of slotsPerChunk linked by atomic pointers, and a chunk is added when more threads
+// read at once than the existing chunks hold, so any number of threads may read. Guards may nest within a thread. Shared products
+// (sharedChair() and the like) belong to the factory, so they must not outlive the guard.
+// A writer waits for every guard, its own included, so publish() throws std::logic_error
+// when the calling thread still holds a guard on the handle instead of waiting forever.
+class FurnitureFactoryHandle {
+public:
+    // Claiming a slot, on a thread's first read, and adding a chunk, on the first read of a thread
+    // whose slot lies beyond the chunks of the handle, are the only steps of read() that are not
+    // wait-free: the first scans the taken slots, the second allocates one chunk
+    static constexpr std::size_t slotsPerChunk = 128;
+
+    class Guard {
+    public:
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        ~Guard() { handle_.leave(); }
+        const FurnitureFactory& operator*() const { return factory_; }
+        const FurnitureFactory* operator->() const { return &factory_; }
+
+    private:
+        friend class FurnitureFactoryHandle;
+        Guard(const FurnitureFactoryHandle& handle, const FurnitureFactory& factory) : handle_(handle), factory_(factory) { }
+
+        const FurnitureFactoryHandle& handle_;
+        const FurnitureFactory& factory_;
+    };
+
+    // The handle does not own a factory passed by reference, which must outlive both the handle
+    // and every guard on it; a factory passed by unique_ptr is destroyed once it is replaced
+    explicit FurnitureFactoryHandle(const FurnitureFactory& initial) : current_(&initial) { }
+    explicit FurnitureFactoryHandle(std::unique_ptr<const FurnitureFactory> initial)
+        : current_(initial.get()), owned_(std::move(initial)) { }
+    FurnitureFactoryHandle(const FurnitureFactoryHandle&) = delete;
+    FurnitureFactoryHandle& operator=(const FurnitureFactoryHandle&) = delete;
+    // No guard may be alive when the handle is destroyed
+    ~FurnitureFactoryHandle() {
+        for (Chunk* chunk = slots_.next.load(); chunk != nullptr;) {
+            delete std::exchange(chunk, chunk->next.load());
+        }
+    }
+
+    Guard read() const {
+        Slot& slot = *this->slot(readerIndex(), true);
+        if (slot.depth++ == 0) {
+            slot.epoch.store(epoch_.load());
+        }
+        return Guard(*this, *current_.load());
+    }
+
+    // Both return once the previous factory can no longer be reached by any reader
+    void publish(std::unique_ptr<const FurnitureFactory> factory) {
+        requireNoGuard();
+        std::lock_guard<std::mutex> lock(writerMutex_);
+        const FurnitureFactory* next = factory.get();
+        std::unique_ptr<const FurnitureFactory> previous = std::exchange(owned_, std::move(factory));
+        replace(next);
+    }
+    void publish(const FurnitureFactory& factory) {
+        requireNoGuard();
+        std::lock_guard<std::mutex> lock(writerMutex_);
+        std::unique_ptr<const FurnitureFactory> previous = std::move(owned_);
+        replace(&factory);
+    }
+
+private:
+    // One cache line per reader, so readers never write to a line another thread reads often.
+    // depth is only touched by the thread holding the slot.
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> epoch {0};
+        std::size_t depth = 0;
+    };
+    struct Chunk {
+        Slot slots[slotsPerChunk];
+        std::atomic<Chunk*> next {nullptr};
+    };
+
+    // The slot at index, adding the chunks up to it when create is set; nullptr when it is not
+    // set and the chunk does not exist yet. Chunks are only freed with the handle.
+    Slot* slot(std::size_t index, bool create) const {
+        Chunk* chunk = &slots_;
+        for (; index >= slotsPerChunk; index -= slotsPerChunk) {
+            Chunk* next = chunk->next.load();
+            if (next == nullptr) {
+                if (!create) {
+                    return nullptr;
+                }
+                Chunk* const added = new Chunk;
+                if (chunk->next.compare_exchange_strong(next, added)) {
+                    next = added;
+                } else {
+                    delete added;
+                }
+            }
+            chunk = next;
+        }
+        return &chunk->slots[index];
+    }
+
+    void leave() const {
+        Slot& slot = *this->slot(readerIndex(), false);
+        if (--slot.depth == 0) {
+            slot.epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    // A thread that has never read holds no guard, and checking does not claim it a slot
+    void requireNoGuard() const {
+        const Slot* slot = claimedIndex_ != noIndex ? this->slot(claimedIndex_, false) : nullptr;
+        if (slot != nullptr && slot->depth != 0) {
+            throw std::logic_error("FurnitureFactoryHandle::publish called while holding a Guard on the handle");
+        }
+    }
+
+    // Must be called with writerMutex_ held; the old owned factory is destroyed by the caller
+    void replace(const FurnitureFactory* next) {
+        current_.exchange(next);
+        const std::uint64_t epoch = epoch_.fetch_add(1) + 1;
+        // A chunk linked after the scan read the link holds only readers that entered after the
+        // exchange above, so they already see the new factory
+        for (const Chunk* chunk = &slots_; chunk != nullptr; chunk = chunk->next.load()) {
+            for (const Slot& slot : chunk->slots) {
+                for (std::uint64_t announced = slot.epoch.load(); announced != 0 && announced < epoch;
+                     announced = slot.epoch.load()) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+    }
+
+    // The slot index of the calling thread, shared by all handles; claimed on first use.
+    // The taken flags grow in chunks like the slots, and are never freed.
+    struct TakenChunk {
+        std::atomic<bool> taken[slotsPerChunk] {};
+        std::atomic<TakenChunk*> next {nullptr};
+    };
+    static std::size_t readerIndex() {
+        static TakenChunk first;
+        struct Reader {
+            std::atomic<bool>* taken = nullptr;
+            std::size_t index = noIndex;
+            Reader() {
+                TakenChunk* chunk = &first;
+                for (std::size_t base = 0;; base += slotsPerChunk) {
+                    for (std::size_t i = 0; i < slotsPerChunk; ++i) {
+                        if (!chunk->taken[i].exchange(true, std::memory_order_acquire)) {
+                            taken = &chunk->taken[i];
+                            index = base + i;
+                            claimedIndex_ = index;
+                            return;
+                        }
+                    }
+                    TakenChunk* next = chunk->next.load();
+                    if (next == nullptr) {
+                        TakenChunk* const added = new TakenChunk;
+                        if (chunk->next.compare_exchange_strong(next, added)) {
+                            next = added;
+                        } else {
+                            delete added;
+                        }
+                    }
+                    chunk = next;
+                }
+            }
+            ~Reader() {
+                claimedIndex_ = noIndex;
+                taken->store(false, std::memory_order_release);
+            }
+        };
+        thread_local const Reader reader;
+        return reader.index;
+    }
+    static constexpr std::size_t noIndex = static_cast<std::size_t>(-1);
+    // The slot index of the calling thread, noIndex until it claims one
+    static inline thread_local std::size_t claimedIndex_ = noIndex;
+
+    // Epochs start at 1, so 0 in a slot means the reader is outside any guard
+    std::atomic<std::uint64_t> epoch_ {1};
+    std::atomic<const FurnitureFactory*> current_;
+    std::unique_ptr<const FurnitureFactory> owned_;
+    // The first chunk is part of the handle, so up to slotsPerChunk readers need no allocation
+    mutable Chunk slots_;
+    std::mutex writerMutex_;
+};
+
+// The typed family: products tagged with their style in the type, so a sofa only accepts a
+// chair, and a coffee table only a sofa, of its own style. A mismatch does not compile, and since
+// the collaborator's type is exact, its message is picked at compile time, with no virtual call.
+// Each typed product holds its concrete product, which product() exposes to runtime code.
+template <FurnitureStyle Style>
+class TypedChair {
+public:
+    using ProductType = typename FurnitureTraits<Style>::ChairType;
+
+    std::string sitOn() const { return std::string(sitOnView()); }
+    std::string_view sitOnView() const { return ProductType::sitOnMessage; }
+    const ProductType& product() const { return product_; }
+
+private:
+    ProductType product_;
+};
+
+template <FurnitureStyle Style>
+class TypedSofa {
+public:
+    using ProductType = typename FurnitureTraits<Style>::SofaType;
+
+    std::string layOn() const { return std::string(layOnView()); }
+    std::string_view layOnView() const { return ProductType::layOnMessage; }
+    std::string putAside(const TypedChair<Style>& collaboratorChair) const {
+        return std::string(putAsideView(collaboratorChair));
+    }
+    std::string_view putAsideView(const TypedChair<Style>&) const {
+        return PutAsideMessages<ProductType>::byChairStyle[static_cast<std::size_t>(Style)];
+    }
+    // A chair of another style is rejected at compile time
+    template <FurnitureStyle Other>
+    std::string putAside(const TypedChair<Other>&) const = delete;
+    template <FurnitureStyle Other>
+    std::string_view putAsideView(const TypedChair<Other>&) const = delete;
+    const ProductType& product() const { return product_; }
+
+private:
+    ProductType product_;
+};
+
+template <FurnitureStyle Style>
+class TypedCoffeeTable {
+public:
+    using ProductType = typename FurnitureTraits<Style>::CoffeeTableType;
+
+    std::string coffeeOnMe() const { return std::string(coffeeOnMeView()); }
+    std::string_view coffeeOnMeView() const { return ProductType::coffeeOnMeMessage; }
+    std::string sittingOn(const TypedSofa<Style>& collaboratorSofa) const {
+        return std::string(sittingOnView(collaboratorSofa));
+    }
+    std::string_view sittingOnView(const TypedSofa<Style>&) const {
+        return SittingOnMessages<ProductType>::bySofaStyle[static_cast<std::size_t>(Style)];
+    }
+    // A sofa of another style is rejected at compile time
+    template <FurnitureStyle Other>
+    std::string sittingOn(const TypedSofa<Other>&) const = delete;
+    template <FurnitureStyle Other>
+    std::string_view sittingOnView(const TypedSofa<Other>&) const = delete;
+    const ProductType& product() const { return product_; }
+
+private:
+    ProductType product_;
+};
+
+// Whether sofa.putAside(chair) and table.sittingOn(sofa) compile for the given products
+template <typename SofaType, typename ChairType, typename = void>
+struct CanPutAside : std::false_type { };
+template <typename SofaType, typename ChairType>
+struct CanPutAside<SofaType, ChairType,
+                   std::void_t<decltype(std::declval<const SofaType&>().putAside(std::declval<const ChairType&>()))>>
+    : std::true_type { };
+template <typename CoffeeTableType, typename SofaType, typename = void>
+struct CanSitOn : std::false_type { };
+template <typename CoffeeTableType, typename SofaType>
+struct CanSitOn<CoffeeTableType, SofaType,
+                std::void_t<decltype(std::declval<const CoffeeTableType&>().sittingOn(std::declval<const SofaType&>()))>>
+    : std::true_type { };
+
+static_assert(CanPutAside<TypedSofa<FurnitureStyle::Modern>, TypedChair<FurnitureStyle::Modern>>::value,
+              "a typed sofa accepts a chair of its own style");
+static_assert(!CanPutAside<TypedSofa<FurnitureStyle::Modern>, TypedChair<FurnitureStyle::Victorian>>::value,
+              "a typed sofa rejects a chair of another style");
+static_assert(CanSitOn<TypedCoffeeTable<FurnitureStyle::ArtDeco>, TypedSofa<FurnitureStyle::ArtDeco>>::value,
+              "a typed coffee table accepts a sofa of its own style");
+static_assert(!CanSitOn<TypedCoffeeTable<FurnitureStyle::ArtDeco>, TypedSofa<FurnitureStyle::Modern>>::value,
+              "a typed coffee table rejects a sofa of another style");
+
+// When the variant is known at build time the family can be selected statically.
+// StaticFurnitureFactory hands the products out by value, so the compiler sees the exact
+// type at every call and can inline the whole chain instead of going through the vtable.
+// The FurnitureFactory hierarchy above stays as the runtime-dispatch fallback.
+template <FurnitureStyle Style>
+class StaticFurnitureFactory {
+public:
+    using ChairType = typename FurnitureTraits<Style>::ChairType;
+    using SofaType = typename FurnitureTraits<Style>::SofaType;
+    using CoffeeTableType = typename FurnitureTraits<Style>::CoffeeTableType;
+
+    ChairType createChair() const {
+        FURNITURE_COUNT_CREATED(Style, FurnitureKind::Chair, 1);
+        return ChairType();
+    }
+    SofaType createSofa() const {
+        FURNITURE_COUNT_CREATED(Style, FurnitureKind::Sofa, 1);
+        return SofaType();
+    }
+    CoffeeTableType createCoffeeTable() const {
+        FURNITURE_COUNT_CREATED(Style, FurnitureKind::CoffeeTable, 1);
+        return CoffeeTableType();
+    }
+    // The same products in the typed family
+    TypedChair<Style> createTypedChair() const {
+        FURNITURE_COUNT_CREATED(Style, FurnitureKind::Chair, 1);
+        return TypedChair<Style>();
+    }
+    TypedSofa<Style> createTypedSofa() const {
+        FURNITURE_COUNT_CREATED(Style, FurnitureKind::Sofa, 1);
+        return TypedSofa<Style>();
+    }
+    TypedCoffeeTable<Style> createTypedCoffeeTable() const {
+        FURNITURE_COUNT_CREATED(Style, FurnitureKind::CoffeeTable, 1);
+        return TypedCoffeeTable<Style>();
+    }
+};
+
+// Same scenario as ClientCode, resolved at compile time.
+template <FurnitureStyle Style>
+void ClientCode(const StaticFurnitureFactory<Style>& factory) {
+    const auto chair = factory.createChair();
+    const auto sofa = factory.createSofa();
+    const auto coffeetable = factory.createCoffeeTable();
+    std::cout<<chair.sitOn();
+    std::cout<<sofa.layOn();
+    std::cout<<sofa.putAside(chair);
+    std::cout<<coffeetable.coffeeOnMe();
+    std::cout<<coffeetable.sittingOn(sofa);
+}
+
+// Same scenario with the typed family: pairing products of two styles would not compile.
+template <FurnitureStyle Style>
+void ClientCodeTyped(const StaticFurnitureFactory<Style>& factory) {
+    const auto chair = factory.createTypedChair();
+    const auto sofa = factory.createTypedSofa();
+    const auto coffeetable = factory.createTypedCoffeeTable();
+    std::cout<<chair.sitOnView();
+    std::cout<<sofa.layOnView();
+    std::cout<<sofa.putAsideView(chair);
+    std::cout<<coffeetable.coffeeOnMeView();
+    std::cout<<coffeetable.sittingOnView(sofa);
+}
+
+struct FurnitureSet {
+    AnyChair chair;
+    AnySofa sofa;
+    AnyCoffeeTable coffeeTable;
+};
+
+template <FurnitureStyle Style>
+FurnitureSet createFurnitureSet() {
+    using Traits = FurnitureTraits<Style>;
+    FURNITURE_COUNT_CREATED(Style, FurnitureKind::Chair, 1);
+    FURNITURE_COUNT_CREATED(Style, FurnitureKind::Sofa, 1);
+    FURNITURE_COUNT_CREATED(Style, FurnitureKind::CoffeeTable, 1);
+    return FurnitureSet{typename Traits::ChairType(), typename Traits::SofaType(),
+                        typename Traits::CoffeeTableType()};
+}
+
+// Throws std::invalid_argument for a style defined at run time
+FurnitureSet createFurnitureSet(FurnitureStyle style) {
+    switch (style) {
+    case FurnitureStyle::Modern:
+        return createFurnitureSet<FurnitureStyle::Modern>();
+    case FurnitureStyle::Victorian:
+        return createFurnitureSet<FurnitureStyle::Victorian>();
+    case FurnitureStyle::ArtDeco:
+        return createFurnitureSet<FurnitureStyle::ArtDeco>();
+    }
+    throw std::invalid_argument("not a built-in furniture style");
+}
+
+std::string sitOn(const AnyChair& chair) {
+    return std::visit([](const auto& c) { return c.sitOn(); }, chair);
+}
+std::string layOn(const AnySofa& sofa) {
+    return std::visit([](const auto& s) { return s.layOn(); }, sofa);
+}
+std::string putAside(const AnySofa& sofa, const AnyChair& chair) {
+    return std::visit([](const auto& s, const auto& c) { return s.putAside(c); }, sofa, chair);
+}
+std::string coffeeOnMe(const AnyCoffeeTable& coffeeTable) {
+    return std::visit([](const auto& t) { return t.coffeeOnMe(); }, coffeeTable);
+}
+std::string sittingOn(const AnyCoffeeTable& coffeeTable, const AnySofa& sofa) {
+    return std::visit([](const auto& t, const auto& s) { return t.sittingOn(s); }, coffeeTable, sofa);
+}
+
+void renderFurniture(const FurnitureSet& set, std::string& out) {
+    std::visit([&out](const auto& c, const auto& s, const auto& t) { renderFurniture(c, s, t, out); },
+               set.chair, set.sofa, set.coffeeTable);
+}
+
+// Same scenario as ClientCode, over a set held by value.
+void ClientCode(const FurnitureSet& set) {
+    std::cout<<sitOn(set.chair);
+    std::cout<<layOn(set.sofa);
+    std::cout<<putAside(set.sofa, set.chair);
+    std::cout<<coffeeOnMe(set.coffeeTable);
+    std::cout<<sittingOn(set.coffeeTable, set.sofa);
+}
+
+// A set whose products are made by the factory on first access, so a request that only
+// touches the coffee table never builds the chair or the sofa. The products are constructed
+// in place, in InlinePoly holders of the set, so making one does not allocate either.
+// Not thread-safe: a lazy set belongs to one request at a time. The factory must outlive it.
+class LazyFurnitureSet {
+public:
+    explicit LazyFurnitureSet(const FurnitureFactory& factory) : factory_(factory) { }
+    LazyFurnitureSet(const LazyFurnitureSet&) = delete;
+    LazyFurnitureSet& operator=(const LazyFurnitureSet&) = delete;
+
+    const Chair& chair() const {
+        return chair_ ? *chair_ : factory_.createChair(chair_);
+    }
+    const Sofa& sofa() const {
+        return sofa_ ? *sofa_ : factory_.createSofa(sofa_);
+    }
+    const CoffeeTable& coffeeTable() const {
+        return coffeeTable_ ? *coffeeTable_ : factory_.createCoffeeTable(coffeeTable_);
+    }
+    // Whether the product has been made yet
+    bool hasChair() const { return static_cast<bool>(chair_); }
+    bool hasSofa() const { return static_cast<bool>(sofa_); }
+    bool hasCoffeeTable() const { return static_cast<bool>(coffeeTable_); }
+
+private:
+    const FurnitureFactory& factory_;
+    mutable InlineChair chair_;
+    mutable InlineSofa sofa_;
+    mutable InlineCoffeeTable coffeeTable_;
+};
+
+// Same scenario as ClientCode; every product is made when the scenario first needs it.
+void ClientCode(const LazyFurnitureSet& set) {
+    FURNITURE_TIME_CLIENT_CODE();
+    std::cout<<set.chair().sitOn();
+    std::cout<<set.sofa().layOn();
+    std::cout<<set.sofa().putAside(set.chair());
+    std::cout<<set.coffeeTable().coffeeOnMe();
+    std::cout<<set.coffeeTable().sittingOn(set.sofa());
+}
+
+void ClientCode(const FurnitureFactory& factory) {
+    FURNITURE_TIME_CLIENT_CODE();
+    const Chair* chair = factory.createChair();
+    const Sofa* sofa = factory.createSofa();
+    const CoffeeTable* coffeetable = factory.createCoffeeTable();
+    std::cout<<chair->sitOn();
+    std::cout<<sofa->layOn();
+    std::cout<<sofa->putAside(*chair);
+    std::cout<<coffeetable->coffeeOnMe();
+    std::cout<<coffeetable->sittingOn(*sofa);
+    delete chair;
+    delete sofa;
+    delete coffeetable;
+}
+
+// Same scenario as above, but the products live in the arena.
+// Their pointers only destroy them, the caller resets the arena when the request is done.
+void ClientCode(const FurnitureFactory& factory, FurnitureArena& arena) {
+    FURNITURE_TIME_CLIENT_CODE();
+    const ProductPtr<Chair> chair = factory.makeChair(arena);
+    const ProductPtr<Sofa> sofa = factory.makeSofa(arena);
+    const ProductPtr<CoffeeTable> coffeetable = factory.makeCoffeeTable(arena);
+    std::cout<<chair->sitOn();
+    std::cout<<sofa->layOn();
+    std::cout<<sofa->putAside(*chair);
+    std::cout<<coffeetable->coffeeOnMe();
+    std::cout<<coffeetable->sittingOn(*sofa);
+}
+
+// Where ClientCode writes its output. A sink can coalesce the many small messages of
+// many runs into a few large writes, instead of one stream insertion per message.
+class OutputSink {
+public:
+    virtual ~OutputSink() { }
+    virtual void write(std::string_view text) = 0;
+    virtual void flush() { }
+};
+
+// Writes every message straight to a stream, like the plain ClientCode does
+class StreamSink : public OutputSink {
+public:
+    explicit StreamSink(std::ostream& stream) : stream_(stream) { }
+    void write(std::string_view text) override {
+        stream_.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+    void flush() override {
+        stream_.flush();
+    }
+
+private:
+    std::ostream& stream_;
+};
+
+// Collects messages in a buffer of its own and hands them to the file once the buffer is
+// full, so the file sees one large write per capacity bytes. Flushes when destroyed.
+class BufferedSink : public OutputSink {
+public:
+    explicit BufferedSink(std::FILE* file, std::size_t capacity = 64 * 1024) : file_(file), capacity_(capacity) {
+        buffer_.reserve(capacity_);
+    }
+    BufferedSink(const BufferedSink&) = delete;
+    BufferedSink& operator=(const BufferedSink&) = delete;
+    ~BufferedSink() override {
+        flush();
+    }
+    void write(std::string_view text) override {
+        if (buffer_.size() + text.size() > capacity_) {
+            drain();
+        }
+        if (text.size() >= capacity_) {
+            std::fwrite(text.data(), 1, text.size(), file_);
+            return;
+        }
+        buffer_.append(text);
+    }
+    void flush() override {
+        drain();
+        std::fflush(file_);
+    }
+
+private:
+    void drain() {
+        if (!buffer_.empty()) {
+            std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+            buffer_.clear();
+        }
+    }
+
+    std::FILE* file_;
+    std::size_t capacity_;
+    std::string buffer_;
+};
+
+// Hands every message to a user-supplied callback, e.g. one that queues it on a socket
+class CallbackSink : public OutputSink {
+public:
+    explicit CallbackSink(std::function<void(std::string_view)> callback) : callback_(std::move(callback)) { }
+    void write(std::string_view text) override {
+        callback_(text);
+    }
+
+private:
+    std::function<void(std::string_view)> callback_;
+};
+
+// Same scenario as ClientCode, with every product kept on the stack
+void ClientCodeInline(const FurnitureFactory& factory) {
+    FURNITURE_TIME_CLIENT_CODE();
+    InlineChair chairHolder;
+    InlineSofa sofaHolder;
+    InlineCoffeeTable coffeeTableHolder;
+    const Chair& chair = factory.createChair(chairHolder);
+    const Sofa& sofa = factory.createSofa(sofaHolder);
+    const CoffeeTable& coffeetable = factory.createCoffeeTable(coffeeTableHolder);
+    std::cout<<chair.sitOn();
+    std::cout<<sofa.layOn();
+    std::cout<<sofa.putAside(chair);
+    std::cout<<coffeetable.coffeeOnMe();
+    std::cout<<coffeetable.sittingOn(sofa);
+}
+
+// Same scenario as ClientCode, with the factory given as a table
+void ClientCode(const FurnitureFactoryTable& factory) {
+    FURNITURE_TIME_CLIENT_CODE();
+    const ProductPtr<Chair> chair(factory.createChair());
+    const ProductPtr<Sofa> sofa(factory.createSofa());
+    const ProductPtr<CoffeeTable> coffeetable(factory.createCoffeeTable());
+    std::cout<<chair->sitOn();
+    std::cout<<sofa->layOn();
+    std::cout<<sofa->putAside(*chair);
+    std::cout<<coffeetable->coffeeOnMe();
+    std::cout<<coffeetable->sittingOn(*sofa);
+}
+
+// Same scenario as ClientCode, with the factory's shared products: nothing is created per call
+void ClientCodeShared(const FurnitureFactory& factory) {
+    FURNITURE_TIME_CLIENT_CODE();
+    const Chair& chair = factory.sharedChair();
+    const Sofa& sofa = factory.sharedSofa();
+    const CoffeeTable& coffeetable = factory.sharedCoffeeTable();
+    std::cout<<chair.sitOn();
+    std::cout<<sofa.layOn();
+    std::cout<<sofa.putAside(chair);
+    std::cout<<coffeetable.coffeeOnMe();
+    std::cout<<coffeetable.sittingOn(sofa);
+}
+
+// Same scenario as ClientCode, written to a sink. The products stay on the stack and
+// the messages come from static storage, so nothing is allocated for built-in styles.
+void ClientCode(const FurnitureFactory& factory, OutputSink& sink) {
+    FURNITURE_TIME_CLIENT_CODE();
+    InlineChair chairHolder;
+    InlineSofa sofaHolder;
+    InlineCoffeeTable coffeeTableHolder;
+    const Chair& chair = factory.createChair(chairHolder);
+    const Sofa& sofa = factory.createSofa(sofaHolder);
+    const CoffeeTable& coffeetable = factory.createCoffeeTable(coffeeTableHolder);
+    sink.write(chair.sitOnView());
+    sink.write(sofa.layOnView());
+    const std::string_view putAside = sofa.putAsideView(chair);
+    if (!putAside.empty()) {
+        sink.write(putAside);
+    } else {
+        sink.write(sofa.putAside(chair));
+    }
+    sink.write(coffeetable.coffeeOnMeView());
+    const std::string_view sittingOn = coffeetable.sittingOnView(sofa);
+    if (!sittingOn.empty()) {
+        sink.write(sittingOn);
+    } else {
+        sink.write(coffeetable.sittingOn(sofa));
+    }
+}
+
+// Benchmarks: run the program with --bench.
+// Every benchmark reports the time, the number of heap allocations and the bytes
+// allocated per operation. The global operator new is replaced so that allocations made
+// inside the standard library are counted too.
+std::atomic<std::size_t> allocationCount {0};
+std::atomic<std::size_t> allocatedBytes {0};
+
+void* operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+// Types aligned beyond max_align_t, such as the cache-line aligned ones, come through here
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    const auto align = static_cast<std::size_t>(alignment);
+#ifdef _MSC_VER
+    if (void* memory = _aligned_malloc(size == 0 ? 1 : size, align)) {
+        return memory;
+    }
+#else
+    // aligned_alloc wants the size to be a multiple of the alignment
+    if (void* memory = std::aligned_alloc(align, ((size == 0 ? 1 : size) + align - 1) / align * align)) {
+        return memory;
+    }
+#endif
+    throw std::bad_alloc();
+}
+// GCC cannot tell that the replaced operator new above pairs with these deletes
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+void operator delete(void* memory, std::align_val_t) noexcept {
+#ifdef _MSC_VER
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
+void operator delete(void* memory, std::size_t, std::align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Swallows everything written to it, so ClientCode can be measured without a terminal
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+std::FILE* openNullDevice() {
+#ifdef _WIN32
+    return std::fopen("NUL", "wb");
+#else
+    return std::fopen("/dev/null", "wb");
+#endif
+}
+
+// body(iterations) performs the operation iterations times and returns a checksum
+// of the results, which keeps the compiler from dropping the work.
+template <typename Body>
+void runBenchmark(const std::string& name, std::size_t iterations, Body body) {
+    const std::size_t allocationsBefore = allocationCount.load();
+    const std::size_t bytesBefore = allocatedBytes.load();
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t checksum = body(iterations);
+    const auto stop = std::chrono::steady_clock::now();
+    const double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    const double allocations = static_cast<double>(allocationCount.load() - allocationsBefore);
+    const double bytes = static_cast<double>(allocatedBytes.load() - bytesBefore);
+    std::cout<<std::left<<std::setw(52)<<name<<std::right<<std::fixed<<std::setprecision(1)
+             <<std::setw(10)<<ns / iterations<<" ns/op"
+             <<std::setw(8)<<allocations / iterations<<" allocs/op"
+             <<std::setw(9)<<bytes / iterations<<" bytes/op"
+             <<"  (checksum "<<checksum<<")\n";
+}
+
+template <typename Product, typename Create>
+std::size_t createAndDelete(std::size_t count, Create create) {
+    std::size_t checksum = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        const Product* product = create();
+        checksum += product != nullptr;
+        delete product;
+    }
+    return checksum;
+}
+
+// Every create* call and every product method of one style, plus a whole ClientCode run
+void runStyleBenchmarks(const std::string& style, const FurnitureFactory& factory, std::size_t count) {
+    runBenchmark(style + "/createChair", count, [&factory](std::size_t n) {
+        return createAndDelete<Chair>(n, [&factory] { return factory.createChair(); });
+    });
+    runBenchmark(style + "/createSofa", count, [&factory](std::size_t n) {
+        return createAndDelete<Sofa>(n, [&factory] { return factory.createSofa(); });
+    });
+    runBenchmark(style + "/createCoffeeTable", count, [&factory](std::size_t n) {
+        return createAndDelete<CoffeeTable>(n, [&factory] { return factory.createCoffeeTable(); });
+    });
+
+    const std::unique_ptr<const Chair> chair(factory.createChair());
+    const std::unique_ptr<const Sofa> sofa(factory.createSofa());
+    const std::unique_ptr<const CoffeeTable> coffeetable(factory.createCoffeeTable());
+    runBenchmark(style + "/sitOn", count, [&chair](std::size_t n) {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            checksum += chair->sitOn().size();
+        }
+        return checksum;
+    });
+    runBenchmark(style + "/layOn", count, [&sofa](std::size_t n) {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            checksum += sofa->layOn().size();
+        }
+        return checksum;
+    });
+    runBenchmark(style + "/putAside", count, [&sofa, &chair](std::size_t n) {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            checksum += sofa->putAside(*chair).size();
+        }
+        return checksum;
+    });
+    runBenchmark(style + "/coffeeOnMe", count, [&coffeetable](std::size_t n) {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            checksum += coffeetable->coffeeOnMe().size();
+        }
+        return checksum;
+    });
+    runBenchmark(style + "/sittingOn", count, [&coffeetable, &sofa](std::size_t n) {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            checksum += coffeetable->sittingOn(*sofa).size();
+        }
+        return checksum;
+    });
+    runBenchmark(style + "/ClientCode", count, [&factory](std::size_t n) {
+        NullBuffer nullBuffer;
+        std::streambuf* const console = std::cout.rdbuf(&nullBuffer);
+        for (std::size_t i = 0; i < n; ++i) {
+            ClientCode(factory);
+        }
+        std::cout.rdbuf(console);
+        return n;
+    });
+    runBenchmark(style + "/ClientCode into BufferedSink", count, [&factory](std::size_t n) {
+        std::FILE* const nullDevice = openNullDevice();
+        {
+            BufferedSink sink(nullDevice);
+            for (std::size_t i = 0; i < n; ++i) {
+                ClientCode(factory, sink);
+            }
+        }
+        std::fclose(nullDevice);
+        return n;
+    });
+    runBenchmark(style + "/ClientCodeShared", count, [&factory](std::size_t n) {
+        NullBuffer nullBuffer;
+        std::streambuf* const console = std::cout.rdbuf(&nullBuffer);
+        for (std::size_t i = 0; i < n; ++i) {
+            ClientCodeShared(factory);
+        }
+        std::cout.rdbuf(console);
+        return n;
+    });
+    runBenchmark(style + "/ClientCodeInline", count, [&factory](std::size_t n) {
+        NullBuffer nullBuffer;
+        std::streambuf* const console = std::cout.rdbuf(&nullBuffer);
+        for (std::size_t i = 0; i < n; ++i) {
+            ClientCodeInline(factory);
+        }
+        std::cout.rdbuf(console);
+        return n;
+    });
+    // A partial view that only shows the coffee table
+    runBenchmark(style + "/coffeeOnMe, eager set", count, [&factory](std::size_t n) {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            const ProductPtr<Chair> chair = factory.makeChair();
+            const ProductPtr<Sofa> sofa = factory.makeSofa();
+            const ProductPtr<CoffeeTable> coffeeTable = factory.makeCoffeeTable();
+            checksum += coffeeTable->coffeeOnMeView().size();
+        }
+        return checksum;
+    });
+    runBenchmark(style + "/coffeeOnMe, LazyFurnitureSet", count, [&factory](std::size_t n) {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            const LazyFurnitureSet set(factory);
+            checksum += set.coffeeTable().coffeeOnMeView().size();
+        }
+        return checksum;
+    });
+}
+
+// The batch benchmarks below build count sets cycling through the three styles and
+// render all of them, so an operation is one set, construction and dispatch included.
+// Renders count sets split over every core. Each thread makes the products of a set, renders
+// them and drops them, either with the shared factories on the heap or with the factories
+// and product pool of its own thread.
+std::size_t renderSetsOnAllCores(std::size_t count, bool threadLocal) {
+    const std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::size_t> checksums(threads);
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (std::size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&checksums, count, threads, threadLocal, t] {
+            std::string buffer;
+            buffer.reserve(1024);
+            std::size_t checksum = 0;
+            for (std::size_t i = t; i < count; i += threads) {
+                const auto style = static_cast<FurnitureStyle>(i % furnitureStyleCount);
+                const FurnitureFactory& factory =
+                    threadLocal ? FurnitureFactoryRegistry::local(style) : FurnitureFactoryRegistry::get(style);
+                const ProductPtr<Chair> chair = threadLocal ? factory.makeLocalChair() : factory.makeChair();
+                const ProductPtr<Sofa> sofa = threadLocal ? factory.makeLocalSofa() : factory.makeSofa();
+                const ProductPtr<CoffeeTable> coffeeTable =
+                    threadLocal ? factory.makeLocalCoffeeTable() : factory.makeCoffeeTable();
+                buffer.clear();
+                renderFurniture(*chair, *sofa, *coffeeTable, buffer);
+                checksum += buffer.size();
+            }
+            checksums[t] = checksum;
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    std::size_t checksum = 0;
+    for (const std::size_t threadChecksum : checksums) {
+        checksum += threadChecksum;
+    }
+    return checksum;
+}
+
+std::size_t renderPointerSets(std::size_t count) {
+    const ModernFurnitureFactory modern;
+    const VictorianFurnitureFactory victorian;
+    const ArtDecoFurnitureFactory artDeco;
+    const FurnitureFactory* factories[] = {&modern, &victorian, &artDeco};
+    std::vector<const Chair*> chairs;
+    std::vector<const Sofa*> sofas;
+    std::vector<const CoffeeTable*> coffeeTables;
+    chairs.reserve(count);
+    sofas.reserve(count);
+    coffeeTables.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        chairs.push_back(factories[i % 3]->createChair());
+        sofas.push_back(factories[i % 3]->createSofa());
+        coffeeTables.push_back(factories[i % 3]->createCoffeeTable());
+    }
+    std::size_t checksum = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        checksum += chairs[i]->sitOn().size() + sofas[i]->layOn().size()
+                  + sofas[i]->putAside(*chairs[i]).size() + coffeeTables[i]->coffeeOnMe().size()
+                  + coffeeTables[i]->sittingOn(*sofas[i]).size();
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        delete chairs[i];
+        delete sofas[i];
+        delete coffeeTables[i];
+    }
+    return checksum;
+}
+
+std::size_t renderVariantSets(std::size_t count) {
+    const FurnitureStyle styles[] = {FurnitureStyle::Modern, FurnitureStyle::Victorian, FurnitureStyle::ArtDeco};
+    std::vector<FurnitureSet> sets;
+    sets.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        sets.push_back(createFurnitureSet(styles[i % 3]));
+    }
+    std::size_t checksum = 0;
+    for (const FurnitureSet& set : sets) {
+        checksum += sitOn(set.chair).size() + layOn(set.sofa).size()
+                  + putAside(set.sofa, set.chair).size() + coffeeOnMe(set.coffeeTable).size()
+                  + sittingOn(set.coffeeTable, set.sofa).size();
+    }
+    return checksum;
+}
+
+std::size_t renderVariantSetsToBuffer(std::size_t count) {
+    const FurnitureStyle styles[] = {FurnitureStyle::Modern, FurnitureStyle::Victorian, FurnitureStyle::ArtDeco};
+    std::vector<FurnitureSet> sets;
+    sets.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        sets.push_back(createFurnitureSet(styles[i % 3]));
+    }
+    std::size_t checksum = 0;
+    std::string buffer;
+    buffer.reserve(1024);
+    for (const FurnitureSet& set : sets) {
+        buffer.clear();
+        renderFurniture(set, buffer);
+        checksum += buffer.size();
+    }
+    return checksum;
+}
+
+std::size_t renderBatchedSets(std::size_t count) {
+    const ModernFurnitureFactory modern;
+    const VictorianFurnitureFactory victorian;
+    const ArtDecoFurnitureFactory artDeco;
+    const FurnitureFactory* factories[] = {&modern, &victorian, &artDeco};
+    std::size_t checksum = 0;
+    std::string buffer;
+    buffer.reserve(1024);
+    for (std::size_t f = 0; f < 3; ++f) {
+        const FurnitureSetBatch batch = factories[f]->createSets(count / 3 + (f < count % 3 ? 1 : 0));
+        for (std::size_t i = 0; i < batch.size(); ++i) {
+            buffer.clear();
+            renderFurniture(batch.chair(i), batch.sofa(i), batch.coffeeTable(i), buffer);
+            checksum += buffer.size();
+        }
+    }
+    return checksum;
+}
+
+// Same sets as renderBatchedSets, all rendered into one string, set by set or in bulk
+std::size_t renderBatchesIntoOneString(std::size_t count, bool bulk) {
+    const ModernFurnitureFactory modern;
+    const VictorianFurnitureFactory victorian;
+    const ArtDecoFurnitureFactory artDeco;
+    const FurnitureFactory* factories[] = {&modern, &victorian, &artDeco};
+    std::vector<FurnitureSetBatch> batches;
+    for (std::size_t f = 0; f < 3; ++f) {
+        batches.push_back(factories[f]->createSets(count / 3 + (f < count % 3 ? 1 : 0)));
+    }
+    std::string rendered;
+    if (bulk) {
+        renderFurnitureBulk(batches, rendered);
+    } else {
+        for (const FurnitureSetBatch& batch : batches) {
+            renderFurniture(batch, rendered);
+        }
+    }
+    return rendered.size();
+}
+
+std::size_t renderCatalog(std::size_t count) {
+    FurnitureCatalog catalog;
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto style = static_cast<FurnitureStyle>(i % furnitureStyleCount);
+        for (std::size_t kind = 0; kind < furnitureKindCount; ++kind) {
+            catalog.add(style, static_cast<FurnitureKind>(kind), static_cast<std::uint32_t>(i));
+        }
+    }
+    std::string rendered;
+    catalog.render(rendered);
+    return rendered.size();
+}
+
+// Maps a snapshot of a count-set catalog and renders it; writing it is not measured.
+std::size_t renderCatalogSnapshot(std::size_t count) {
+    static const char* path = [] {
+        FurnitureCatalog catalog;
+        for (std::size_t i = 0; i < 1000; ++i) {
+            const auto style = static_cast<FurnitureStyle>(i % furnitureStyleCount);
+            for (std::size_t kind = 0; kind < furnitureKindCount; ++kind) {
+                catalog.add(style, static_cast<FurnitureKind>(kind), static_cast<std::uint32_t>(i));
+            }
+        }
+        const char* snapshotPath = "furniture-catalog-bench.snapshot";
+        writeCatalogSnapshot(catalog, snapshotPath);
+        return snapshotPath;
+    }();
+    std::size_t checksum = 0;
+    std::string rendered;
+    for (std::size_t i = 0; i < count; i += 1000) {
+        if (const std::optional<CatalogSnapshot> snapshot = CatalogSnapshot::open(path)) {
+            rendered.clear();
+            snapshot->render(rendered);
+            checksum += rendered.size();
+        }
+    }
+    return checksum;
+}
+
+// Keeps a benchmarked loop out of line, so the caller's knowledge of the dynamic type does not leak in
+#if defined(__GNUC__)
+#define BENCHMARK_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define BENCHMARK_NOINLINE __declspec(noinline)
+#else
+#define BENCHMARK_NOINLINE
+#endif
+
+// Renders count sets with the products on the stack, through the FurnitureFactory interface:
+// every create and product call stays virtual in every build.
+BENCHMARK_NOINLINE std::size_t renderViaInterface(const FurnitureFactory& factory, std::size_t count) {
+    std::size_t checksum = 0;
+    std::string buffer;
+    buffer.reserve(1024);
+    for (std::size_t i = 0; i < count; ++i) {
+        InlineChair chairHolder;
+        InlineSofa sofaHolder;
+        InlineCoffeeTable coffeeTableHolder;
+        const Chair& chair = factory.createChair(chairHolder);
+        const Sofa& sofa = factory.createSofa(sofaHolder);
+        const CoffeeTable& coffeetable = factory.createCoffeeTable(coffeeTableHolder);
+        buffer.clear();
+        renderFurniture(chair, sofa, coffeetable, buffer);
+        checksum += buffer.size();
+    }
+    return checksum;
+}
+
+// The same loop on the concrete factory and products of Style. In a sealed build every call
+// is resolved statically and can be inlined. In an open build a subclass could still override
+// them, so they stay virtual, although the compiler may guess the target and check it at run time.
+template <FurnitureStyle Style, typename ConcreteFactory>
+BENCHMARK_NOINLINE std::size_t renderViaConcreteTypes(const ConcreteFactory& factory, std::size_t count) {
+    using Traits = FurnitureTraits<Style>;
+    std::size_t checksum = 0;
+    std::string buffer;
+    buffer.reserve(1024);
+    for (std::size_t i = 0; i < count; ++i) {
+        InlineChair chairHolder;
+        InlineSofa sofaHolder;
+        InlineCoffeeTable coffeeTableHolder;
+        const auto& chair = static_cast<const typename Traits::ChairType&>(factory.createChair(chairHolder));
+        const auto& sofa = static_cast<const typename Traits::SofaType&>(factory.createSofa(sofaHolder));
+        const auto& coffeetable =
+            static_cast<const typename Traits::CoffeeTableType&>(factory.createCoffeeTable(coffeeTableHolder));
+        buffer.clear();
+        buffer.append(chair.sitOnView());
+        buffer.append(sofa.layOnView());
+        sofa.putAside(chair, buffer);
+        buffer.append(coffeetable.coffeeOnMeView());
+        coffeetable.sittingOn(sofa, buffer);
+        checksum += buffer.size();
+    }
+    return checksum;
+}
+
+template <FurnitureStyle Style, typename ConcreteFactory>
+void runDevirtualizationBenchmarks(const std::string& style, std::size_t count) {
+    const ConcreteFactory factory;
+    runBenchmark(style + "/render via FurnitureFactory&", count, [&factory](std::size_t n) {
+        return renderViaInterface(factory, n);
+    });
+    runBenchmark(style + "/render via concrete types", count, [&factory](std::size_t n) {
+        return renderViaConcreteTypes<Style>(factory, n);
+    });
+}
+
+// The typed family resolves every collaborator message at compile time
+template <FurnitureStyle Style>
+void runTypedFamilyBenchmark(const std::string& style, std::size_t count) {
+    runBenchmark(style + "/render typed family", count, [](std::size_t n) {
+        const StaticFurnitureFactory<Style> factory;
+        std::size_t checksum = 0;
+        std::string buffer;
+        buffer.reserve(1024);
+        for (std::size_t i = 0; i < n; ++i) {
+            const auto chair = factory.createTypedChair();
+            const auto sofa = factory.createTypedSofa();
+            const auto coffeeTable = factory.createTypedCoffeeTable();
+            buffer.clear();
+            buffer.append(chair.sitOnView());
+            buffer.append(sofa.layOnView());
+            buffer.append(sofa.putAsideView(chair));
+            buffer.append(coffeeTable.coffeeOnMeView());
+            buffer.append(coffeeTable.sittingOnView(sofa));
+            checksum += buffer.size();
+        }
+        return checksum;
+    });
+}
+
+void runBenchmarks() {
+    const std::size_t count = 1000000;
+#ifdef DESIGN_PATTERNS_SEALED
+    std::cout<<"Sealed hierarchy: concrete classes are final\n";
+#else
+    std::cout<<"Open hierarchy: build with -DDESIGN_PATTERNS_SEALED to mark concrete classes final\n";
+#endif
+    runStyleBenchmarks("Modern", ModernFurnitureFactory(), count);
+    runStyleBenchmarks("Victorian", VictorianFurnitureFactory(), count);
+    runStyleBenchmarks("ArtDeco", ArtDecoFurnitureFactory(), count);
+    const FurnitureStyleTable styleTable(rusticStyleConfig);
+    runStyleBenchmarks("Rustic (data-driven)", DataDrivenFurnitureFactory(*styleTable.find("Rustic")), count);
+    runDevirtualizationBenchmarks<FurnitureStyle::Modern, ModernFurnitureFactory>("Modern", count);
+    runDevirtualizationBenchmarks<FurnitureStyle::Victorian, VictorianFurnitureFactory>("Victorian", count);
+    runDevirtualizationBenchmarks<FurnitureStyle::ArtDeco, ArtDecoFurnitureFactory>("ArtDeco", count);
+    runTypedFamilyBenchmark<FurnitureStyle::Modern>("Modern", count);
+    const FurnitureFactoryHandle handle(FurnitureFactoryRegistry::get(FurnitureStyle::Modern));
+    runBenchmark("FurnitureFactoryHandle::read + render", count, [&handle](std::size_t n) {
+        std::size_t checksum = 0;
+        std::string buffer;
+        buffer.reserve(1024);
+        for (std::size_t i = 0; i < n; ++i) {
+            const FurnitureFactoryHandle::Guard factory = handle.read();
+            buffer.clear();
+            renderFurniture(factory->sharedChair(), factory->sharedSofa(), factory->sharedCoffeeTable(), buffer);
+            checksum += buffer.size();
+        }
+        return checksum;
+    });
+    runBenchmark("FurnitureFactoryRegistry::get + render", count, [](std::size_t n) {
+        std::size_t checksum = 0;
+        std::string buffer;
+        buffer.reserve(1024);
+        for (std::size_t i = 0; i < n; ++i) {
+            const FurnitureFactory& factory = FurnitureFactoryRegistry::get(FurnitureStyle::Modern);
+            buffer.clear();
+            renderFurniture(factory.sharedChair(), factory.sharedSofa(), factory.sharedCoffeeTable(), buffer);
+            checksum += buffer.size();
+        }
+        return checksum;
+    });
+    runTypedFamilyBenchmark<FurnitureStyle::Victorian>("Victorian", count);
+    runTypedFamilyBenchmark<FurnitureStyle::ArtDeco>("ArtDeco", count);
+    runBenchmark("FurnitureFactoryTable::createChair", count, [](std::size_t n) {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            const FurnitureFactoryTable table = furnitureFactoryTable(static_cast<FurnitureStyle>(i % furnitureStyleCount));
+            const ProductPtr<Chair> chair(table.createChair());
+            checksum += chair != nullptr;
+        }
+        return checksum;
+    });
+    runBenchmark("FurnitureFactoryRegistry::find", count, [](std::size_t n) {
+        const std::string_view names[] = {"modern", "Victorian", "ARTDECO"};
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            checksum += FurnitureFactoryRegistry::find(names[i % 3]) != nullptr;
+        }
+        return checksum;
+    });
+    runBenchmark("sets/pointer FurnitureFactory", count, renderPointerSets);
+    runBenchmark("sets/all cores, shared factories on the heap", count,
+                 [](std::size_t n) { return renderSetsOnAllCores(n, false); });
+    runBenchmark("sets/all cores, thread-local factories and pools", count,
+                 [](std::size_t n) { return renderSetsOnAllCores(n, true); });
+    runBenchmark("sets/variant FurnitureSet", count, renderVariantSets);
+    runBenchmark("sets/variant FurnitureSet into buffer", count, renderVariantSetsToBuffer);
+    runBenchmark("sets/FurnitureFactory::createSets into buffer", count, renderBatchedSets);
+    runBenchmark("sets/createSets, rendered set by set into one string", count,
+                 [](std::size_t n) { return renderBatchesIntoOneString(n, false); });
+    runBenchmark("sets/createSets, renderFurnitureBulk into one string", count,
+                 [](std::size_t n) { return renderBatchesIntoOneString(n, true); });
+    runBenchmark("sets/FurnitureCatalog::render (fixed messages only)", count, renderCatalog);
+    runBenchmark("sets/CatalogSnapshot::open+render (per 1000 sets)", count, renderCatalogSnapshot);
+    std::remove("furniture-catalog-bench.snapshot");
+}
+
+// Allocation checks: run the program with --check-allocs.
+// Every check runs its body once to set up whatever is created lazily (shared products,
+// pools, stream buffers), then runs it again and fails if that allocated anything.
+// The program exits with a failure status if any check failed, so a build can run it
+// to catch per-call allocations creeping back into these paths.
+template <typename Body>
+bool checkNoAllocations(const std::string& name, Body body) {
+    constexpr std::size_t runs = 100;
+    body();
+    const std::size_t allocationsBefore = allocationCount.load();
+    for (std::size_t i = 0; i < runs; ++i) {
+        body();
+    }
+    const std::size_t allocations = allocationCount.load() - allocationsBefore;
+    std::cout<<std::left<<std::setw(52)<<name;
+    if (allocations == 0) {
+        std::cout<<"ok\n";
+    } else {
+        std::cout<<"FAILED: "<<allocations<<" allocations in "<<runs<<" runs\n";
+    }
+    return allocations == 0;
+}
+
+bool checkFactoryAllocations(const std::string& style, const FurnitureFactory& factory, std::FILE* nullDevice) {
+    bool passed = true;
+    std::string buffer;
+    buffer.reserve(1024);
+    alignas(std::max_align_t) unsigned char storage[256];
+    FurnitureArena arena(storage, sizeof(storage));
+    BufferedSink sink(nullDevice);
+
+    passed &= checkNoAllocations(style + "/ClientCode into BufferedSink", [&] { ClientCode(factory, sink); });
+    passed &= checkNoAllocations(style + "/arena products rendered", [&] {
+        arena.reset();
+        const Chair* chair = factory.createChair(arena);
+        const Sofa* sofa = factory.createSofa(arena);
+        const CoffeeTable* coffeeTable = factory.createCoffeeTable(arena);
+        buffer.clear();
+        renderFurniture(*chair, *sofa, *coffeeTable, buffer);
+    });
+    passed &= checkNoAllocations(style + "/inline products rendered", [&] {
+        InlineChair chairHolder;
+        InlineSofa sofaHolder;
+        InlineCoffeeTable coffeeTableHolder;
+        buffer.clear();
+        renderFurniture(factory.createChair(chairHolder), factory.createSofa(sofaHolder),
+                        factory.createCoffeeTable(coffeeTableHolder), buffer);
+    });
+    passed &= checkNoAllocations(style + "/shared products rendered", [&] {
+        buffer.clear();
+        renderFurniture(factory.sharedChair(), factory.sharedSofa(), factory.sharedCoffeeTable(), buffer);
+    });
+    passed &= checkNoAllocations(style + "/LazyFurnitureSet rendered", [&] {
+        const LazyFurnitureSet set(factory);
+        buffer.clear();
+        renderFurniture(set.chair(), set.sofa(), set.coffeeTable(), buffer);
+    });
+    passed &= checkNoAllocations(style + "/thread pool products rendered", [&] {
+        const ProductPtr<Chair> chair = factory.makeLocalChair();
+        const ProductPtr<Sofa> sofa = factory.makeLocalSofa();
+        const ProductPtr<CoffeeTable> coffeeTable = factory.makeLocalCoffeeTable();
+        buffer.clear();
+        renderFurniture(*chair, *sofa, *coffeeTable, buffer);
+    });
+    return passed;
+}
+
+int runAllocationChecks() {
+    std::FILE* const nullDevice = openNullDevice();
+    bool passed = true;
+    passed &= checkFactoryAllocations("Modern", ModernFurnitureFactory(), nullDevice);
+    passed &= checkFactoryAllocations("Victorian", VictorianFurnitureFactory(), nullDevice);
+    passed &= checkFactoryAllocations("ArtDeco", ArtDecoFurnitureFactory(), nullDevice);
+    const FurnitureStyleTable styleTable(rusticStyleConfig);
+    passed &= checkFactoryAllocations("Rustic (data-driven)", DataDrivenFurnitureFactory(*styleTable.find("Rustic")),
+                                      nullDevice);
+
+    const FurnitureFactoryHandle handle(FurnitureFactoryRegistry::get(FurnitureStyle::ArtDeco));
+    passed &= checkNoAllocations("FurnitureFactoryHandle::read", [&handle] {
+        if (handle.read()->sharedChair().sitOnView().empty()) {
+            std::abort();
+        }
+    });
+    passed &= checkNoAllocations("FurnitureFactoryRegistry::find", [] {
+        if (FurnitureFactoryRegistry::find("ArtDeco") == nullptr) {
+            std::abort();
+        }
+    });
+    passed &= checkNoAllocations("FurnitureFactoryTable in an arena", [] {
+        alignas(std::max_align_t) unsigned char storage[64];
+        FurnitureArena arena(storage, sizeof(storage));
+        const FurnitureFactoryTable table = furnitureFactoryTable(FurnitureStyle::Victorian);
+        if (table.createChairInArena(arena)->sitOnView().empty()) {
+            std::abort();
+        }
+    });
+    std::fclose(nullDevice);
+    std::cout<<(passed ? "All allocation checks passed\n" : "Some allocation checks FAILED\n");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Self checks: run the program with --self-check.
+// Every check compares what a path renders with the text it must produce.
+bool checkRendered(const std::string& name, const std::string& rendered, std::string_view expected) {
+    std::cout<<std::left<<std::setw(52)<<name;
+    if (rendered == expected) {
+        std::cout<<"ok\n";
+        return true;
+    }
+    std::cout<<"FAILED: got \""<<rendered<<"\"\n";
+    return false;
+}
+
+// Two tables give out the same ids, so products of their styles must not be taken for one style
+bool checkSeparateStyleTables() {
+    const FurnitureStyleTable rusticTable(rusticStyleConfig);
+    const FurnitureStyleTable nordicTable(R"([Nordic]
+sitOn = You can sit on NORDIC chair\n
+layOn = You can lie on NORDIC Sofa\n
+putAside = "Now you can lie on Nordic sofa and "
+coffeeOnMe = You're enjoying a cup of coffee on Nordic Coffee Table\n
+sittingOn = Enjoy your coffee on Nordic Coffee Table\n
+)");
+    const DataDrivenStyle& rustic = *rusticTable.find("Rustic");
+    const DataDrivenStyle& nordic = *nordicTable.find("Nordic");
+    bool passed = true;
+    passed &= checkRendered("two tables/same id", rustic.id == nordic.id ? "same" : "different", "same");
+    passed &= checkRendered("two tables/Rustic sofa, Nordic chair",
+                            DataDrivenSofa(rustic).putAside(DataDrivenChair(nordic)),
+                            "Now you can lie on Rustic sofa and You can sit on NORDIC chair\n");
+    passed &= checkRendered("two tables/Nordic coffee table, Rustic sofa",
+                            DataDrivenCoffeeTable(nordic).sittingOn(DataDrivenSofa(rustic)),
+                            "You can lie on RUSTIC Sofa\nEnjoy your coffee on Nordic Coffee Table\n");
+    passed &= checkRendered("two tables/Rustic sofa, Rustic chair",
+                            DataDrivenSofa(rustic).putAside(DataDrivenChair(rustic)),
+                            "Now you can lie on Rustic sofa and You can sit on RUSTIC chair\n");
+    return passed;
+}
+
+// More threads hold a guard at once than one chunk of reader slots has room for
+bool checkManyReaders() {
+    FurnitureFactoryHandle handle(FurnitureFactoryRegistry::get(FurnitureStyle::Modern));
+    const std::size_t readers = 2 * FurnitureFactoryHandle::slotsPerChunk + 1;
+    std::atomic<std::size_t> reading {0};
+    std::atomic<std::size_t> wrong {0};
+    std::atomic<bool> release {false};
+    std::vector<std::thread> threads;
+    threads.reserve(readers);
+    for (std::size_t t = 0; t < readers; ++t) {
+        threads.emplace_back([&] {
+            const FurnitureFactoryHandle::Guard factory = handle.read();
+            reading.fetch_add(1);
+            while (!release.load()) {
+                std::this_thread::yield();
+            }
+            if (factory->sharedChair().sitOnView() != ModernChair::sitOnMessage) {
+                wrong.fetch_add(1);
+            }
+        });
+    }
+    while (reading.load() < readers) {
+        std::this_thread::yield();
+    }
+    release.store(true);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    handle.publish(FurnitureFactoryRegistry::get(FurnitureStyle::Victorian));
+    return checkRendered("FurnitureFactoryHandle/" + std::to_string(readers) + " readers at once",
+                         wrong.load() == 0 ? std::string(handle.read()->sharedChair().sitOnView()) : "a wrong factory",
+                         VictorianChair::sitOnMessage);
+}
+
+int runSelfChecks() {
+    bool passed = checkSeparateStyleTables();
+    passed &= checkManyReaders();
+    std::cout<<(passed ? "All self checks passed\n" : "Some self checks FAILED\n");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Load generation: run the program with --load [rate] [threads] [seconds].
+// Every thread issues rate requests per second (0 runs them back to back) for the given
+// number of seconds per mode. A request's latency is measured from the time it was due,
+// not from when it started, so a stall also counts against the requests queued behind it.
+// Latencies go into a log-linear histogram: each power of two is split into 32 buckets,
+// which keeps every recorded value within about 3% across the whole range.
+class LatencyHistogram {
+public:
+    static constexpr std::size_t subBucketBits = 5;
+    static constexpr std::size_t subBucketCount = std::size_t(1) << subBucketBits;
+    // Shifts run from 0 to 64 - (subBucketBits + 1), and each of them starts a row of buckets
+    static constexpr std::size_t bucketCount = (64 - subBucketBits + 1) * subBucketCount;
+
+    void record(std::uint64_t ns) {
+        ++counts_[index(ns)];
+        ++total_;
+        max_ = std::max(max_, ns);
+    }
+    void add(const LatencyHistogram& other) {
+        for (std::size_t i = 0; i < bucketCount; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+    std::uint64_t count() const { return total_; }
+    std::uint64_t max() const { return max_; }
+    // The upper edge of the bucket holding the q-th quantile, q in [0, 1]
+    std::uint64_t percentile(double q) const {
+        const auto rank = static_cast<std::uint64_t>(q * static_cast<double>(total_));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucketCount; ++i) {
+            seen += counts_[i];
+            if (seen > rank) {
+                return std::min(upperEdge(i), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    // Values below 2 * subBucketCount get a bucket each; above, the top subBucketBits + 1
+    // bits of the value select the bucket within its power of two
+    static std::size_t index(std::uint64_t value) {
+        if (value < 2 * subBucketCount) {
+            return static_cast<std::size_t>(value);
+        }
+        std::size_t shift = 0;
+        while ((value >> shift) >= 2 * subBucketCount) {
+            ++shift;
+        }
+        return (shift + 1) * subBucketCount + static_cast<std::size_t>((value >> shift) - subBucketCount);
+    }
+    static std::uint64_t upperEdge(std::size_t index) {
+        if (index < 2 * subBucketCount) {
+            return index;
+        }
+        const std::size_t shift = index / subBucketCount - 1;
+        const std::uint64_t lower = static_cast<std::uint64_t>(index % subBucketCount + subBucketCount) << shift;
+        return lower + (std::uint64_t(1) << shift) - 1;
+    }
+
+    std::vector<std::uint64_t> counts_ = std::vector<std::uint64_t>(bucketCount);
+    std::uint64_t total_ = 0;
+    std::uint64_t max_ = 0;
+};
+
+struct LoadOptions {
+    // Requests per second per thread, fractions included; 0 runs them back to back
+    double rate = 20000;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    double seconds = 1.0;
+};
+
+// Parses [rate] [threads] [seconds]; an empty optional, after printing the usage, on bad input
+std::optional<LoadOptions> parseLoadOptions(int argc, char* argv[]) {
+    LoadOptions options;
+    const auto number = [](const char* text, double& value) {
+        char* end = nullptr;
+        value = std::strtod(text, &end);
+        return end != text && *end == '\0' && value >= 0.0;
+    };
+    double values[3] = {options.rate, static_cast<double>(options.threads), options.seconds};
+    // Upper bounds that keep the conversions below defined, and the run within reason
+    constexpr double limits[3] = {1e9, 4096.0, 86400.0};
+    // A slower rate would not issue a single request in the longest run
+    constexpr double minRate = 1.0 / limits[2];
+    for (int i = 0; i < argc; ++i) {
+        if (i >= 3 || !number(argv[i], values[i]) || !(values[i] <= limits[i]) ||
+            (i == 0 && values[i] != 0.0 && values[i] < minRate)) {
+            std::cerr<<"usage: --load [requests per second per thread, 0 for back to back] [threads] [seconds per mode]\n"
+                     <<"at least "<<minRate<<" and at most "<<limits[0]<<" requests per second, "<<limits[1]<<" threads and "<<limits[2]<<" seconds\n";
+            return std::nullopt;
+        }
+    }
+    options.rate = values[0];
+    options.threads = std::max<std::size_t>(1, static_cast<std::size_t>(values[1]));
+    options.seconds = values[2];
+    return options;
+}
+
+// Runs request(thread, i) on every thread for options.seconds and prints the latency percentiles
+template <typename Request>
+void runLoad(const std::string& name, const LoadOptions& options, Request request) {
+    using Clock = std::chrono::steady_clock;
+    const auto duration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    const auto interval = options.rate == 0 ? Clock::duration::zero()
+                                            : std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double>(1.0 / options.rate));
+    std::vector<LatencyHistogram> histograms(options.threads);
+    std::vector<std::thread> threads;
+    threads.reserve(options.threads);
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point stop = start + duration;
+    for (std::size_t t = 0; t < options.threads; ++t) {
+        threads.emplace_back([&, t] {
+            LatencyHistogram& histogram = histograms[t];
+            for (std::size_t i = 0;; ++i) {
+                Clock::time_point due = start + interval * static_cast<Clock::rep>(i);
+                if (interval == Clock::duration::zero()) {
+                    due = Clock::now();
+                }
+                if (due >= stop) {
+                    break;
+                }
+                while (Clock::now() < due) {
+                    std::this_thread::yield();
+                }
+                request(t, i);
+                histogram.record(static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - due).count()));
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    LatencyHistogram all;
+    for (const LatencyHistogram& histogram : histograms) {
+        all.add(histogram);
+    }
+    std::cout<<std::left<<std::setw(36)<<name<<std::right<<std::fixed<<std::setprecision(0)
+             <<std::setw(10)<<static_cast<double>(all.count()) / elapsed<<" req/s"
+             <<"  p50 "<<std::setw(8)<<all.percentile(0.5)<<" ns"
+             <<"  p99 "<<std::setw(8)<<all.percentile(0.99)<<" ns"
+             <<"  p99.9 "<<std::setw(9)<<all.percentile(0.999)<<" ns"
+             <<"  max "<<std::setw(10)<<all.max()<<" ns\n";
+}
+
+// The typed family, rendered for the style picked by the request
+template <FurnitureStyle Style>
+void renderTypedFamily(std::string& out) {
+    const StaticFurnitureFactory<Style> factory;
+    const auto chair = factory.createTypedChair();
+    const auto sofa = factory.createTypedSofa();
+    const auto coffeeTable = factory.createTypedCoffeeTable();
+    out.append(chair.sitOnView());
+    out.append(sofa.layOnView());
+    out.append(sofa.putAsideView(chair));
+    out.append(coffeeTable.coffeeOnMeView());
+    out.append(coffeeTable.sittingOnView(sofa));
+}
+
+// Every request renders one set, cycling through the styles, into a buffer of its thread:
+// heap makes the products with new and builds a string per message like ClientCode,
+// pooled takes them from the thread's factories and product pool and renders the views,
+// static uses the typed family, which makes nothing on the heap and calls nothing virtually.
+int runLoadGenerator(const LoadOptions& options) {
+    std::cout<<"Rendering furniture sets: "<<options.threads<<" threads, ";
+    if (options.rate == 0) {
+        std::cout<<"back to back";
+    } else {
+        std::cout<<options.rate<<" requests/s each";
+    }
+    std::cout<<", "<<options.seconds<<" s per mode\n";
+    struct alignas(64) Buffer {
+        std::string text;
+    };
+    std::vector<Buffer> buffers(options.threads);
+    for (Buffer& buffer : buffers) {
+        buffer.text.reserve(1024);
+    }
+    runLoad("heap: new products, string results", options, [&buffers](std::size_t thread, std::size_t i) {
+        const FurnitureFactory& factory = FurnitureFactoryRegistry::get(static_cast<FurnitureStyle>(i % furnitureStyleCount));
+        const ProductPtr<Chair> chair = factory.makeChair();
+        const ProductPtr<Sofa> sofa = factory.makeSofa();
+        const ProductPtr<CoffeeTable> coffeeTable = factory.makeCoffeeTable();
+        std::string& out = buffers[thread].text;
+        out.clear();
+        out += chair->sitOn();
+        out += sofa->layOn();
+        out += sofa->putAside(*chair);
+        out += coffeeTable->coffeeOnMe();
+        out += coffeeTable->sittingOn(*sofa);
+    });
+    runLoad("pooled: thread-local products, views", options, [&buffers](std::size_t thread, std::size_t i) {
+        const FurnitureFactory& factory = FurnitureFactoryRegistry::local(static_cast<FurnitureStyle>(i % furnitureStyleCount));
+        const ProductPtr<Chair> chair = factory.makeLocalChair();
+        const ProductPtr<Sofa> sofa = factory.makeLocalSofa();
+        const ProductPtr<CoffeeTable> coffeeTable = factory.makeLocalCoffeeTable();
+        std::string& out = buffers[thread].text;
+        out.clear();
+        renderFurniture(*chair, *sofa, *coffeeTable, out);
+    });
+    runLoad("static: typed family", options, [&buffers](std::size_t thread, std::size_t i) {
+        std::string& out = buffers[thread].text;
+        out.clear();
+        switch (static_cast<FurnitureStyle>(i % furnitureStyleCount)) {
+        case FurnitureStyle::Modern:
+            renderTypedFamily<FurnitureStyle::Modern>(out);
+            break;
+        case FurnitureStyle::Victorian:
+            renderTypedFamily<FurnitureStyle::Victorian>(out);
+            break;
+        default:
+            renderTypedFamily<FurnitureStyle::ArtDeco>(out);
+            break;
+        }
+    });
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && std::strcmp(argv[1], "--bench") == 0) {
+        runBenchmarks();
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--check-allocs") == 0) {
+        return runAllocationChecks();
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--self-check") == 0) {
+        return runSelfChecks();
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--load") == 0) {
+        const std::optional<LoadOptions> options = parseLoadOptions(argc - 2, argv + 2);
+        return options ? runLoadGenerator(*options) : EXIT_FAILURE;
+    }
+    std::cout<<"Client's code testing with the Modern Furniture factory\n";
+    FurnitureFactory* modernFurnitureFactory = new ModernFurnitureFactory;
+    ClientCode(*modernFurnitureFactory);
+    delete modernFurnitureFactory;
+    std::cout<<"\nTesting Victorian Furniture factory\n";
+    FurnitureFactory* victorianFurnitureFactory = new VictorianFurnitureFactory;
+    ClientCode(*victorianFurnitureFactory);
+    delete victorianFurnitureFactory;
+    std::cout<<"\nTesting ArtDeco Furniture factory\n";
+    FurnitureFactory* artDecoFurnitureFactory = new ArtDecoFurnitureFactory;
+    ClientCode(*artDecoFurnitureFactory);
+    delete artDecoFurnitureFactory;
+
+    std::cout<<"\nTesting ArtDeco Furniture factory with an arena\n";
+    alignas(std::max_align_t) unsigned char buffer[256];
+    FurnitureArena arena(buffer, sizeof(buffer));
+    ClientCode(ArtDecoFurnitureFactory(), arena);
+    arena.reset();
+
+    std::cout<<"\nTesting Modern Furniture factory with products on the stack\n";
+    ClientCodeInline(ModernFurnitureFactory());
+
+    std::cout<<"\nTesting ArtDeco Furniture factory writing to a buffered sink\n";
+    std::cout.flush();
+    {
+        BufferedSink sink(stdout);
+        ClientCode(ArtDecoFurnitureFactory(), sink);
+    }
+
+    std::cout<<"\nTesting the shared products of the registry's Modern Furniture factory\n";
+    ClientCodeShared(FurnitureFactoryRegistry::get(FurnitureStyle::Modern));
+
+    std::cout<<"\nTesting Victorian products from this thread's factory and product pool\n";
+    {
+        const FurnitureFactory& localFactory = FurnitureFactoryRegistry::local(FurnitureStyle::Victorian);
+        const ProductPtr<Chair> chair = localFactory.makeLocalChair();
+        const ProductPtr<Sofa> sofa = localFactory.makeLocalSofa();
+        std::cout<<sofa->putAside(*chair);
+    }
+
+    std::cout<<"\nTesting the ArtDeco factory table\n";
+    ClientCode(furnitureFactoryTable(FurnitureStyle::ArtDeco));
+    const std::vector<FurnitureSetBatch> tableBatches = buildSets(furnitureFactoryTables, 1);
+    for (const FurnitureSetBatch& batch : tableBatches) {
+        std::cout<<batch.chair(0).sitOn();
+    }
+
+    std::cout<<"\nTesting static Victorian Furniture factory\n";
+    ClientCode(StaticFurnitureFactory<FurnitureStyle::Victorian>());
+
+    std::cout<<"\nTesting the typed ArtDeco family\n";
+    ClientCodeTyped(StaticFurnitureFactory<FurnitureStyle::ArtDeco>());
+
+    std::cout<<"\nTesting Modern Furniture set held by value\n";
+    ClientCode(createFurnitureSet(FurnitureStyle::Modern));
+
+    std::cout<<"\nTesting a batch of two Victorian sets\n";
+    std::string rendered;
+    renderFurniture(VictorianFurnitureFactory().createSets(2), rendered);
+    std::cout<<rendered;
+
+    std::cout<<"\nTesting a Modern and an ArtDeco set rendered in bulk\n";
+    std::vector<FurnitureSetBatch> bulkBatches;
+    bulkBatches.push_back(ModernFurnitureFactory().createSets(1));
+    bulkBatches.push_back(ArtDecoFurnitureFactory().createSets(1));
+    rendered.clear();
+    renderFurnitureBulk(bulkBatches, rendered);
+    std::cout<<rendered;
+
+    std::cout<<"\nTesting a catalog with one product of each ArtDeco kind\n";
+    FurnitureCatalog catalog;
+    catalog.add(FurnitureStyle::ArtDeco, FurnitureKind::Chair, 1);
+    catalog.add(FurnitureStyle::ArtDeco, FurnitureKind::Sofa, 2);
+    catalog.add(FurnitureStyle::ArtDeco, FurnitureKind::CoffeeTable, 3);
+    rendered.clear();
+    catalog.render(rendered);
+    std::cout<<rendered;
+
+    std::cout<<"\nTesting the same catalog written to a snapshot and mapped back\n";
+    const char* snapshotPath = "furniture-catalog.snapshot";
+    if (writeCatalogSnapshot(catalog, snapshotPath)) {
+        if (const std::optional<CatalogSnapshot> snapshot = CatalogSnapshot::open(snapshotPath)) {
+            const MappedChair chair = snapshot->chair(0);
+            const MappedSofa sofa = snapshot->sofa(1);
+            const MappedCoffeeTable coffeeTable = snapshot->coffeeTable(2);
+            std::cout<<chair.sitOn();
+            std::cout<<sofa.putAside(chair);
+            std::cout<<coffeeTable.sittingOn(sofa);
+        }
+        std::remove(snapshotPath);
+    }
+
+    std::cout<<"\nTesting a lazy Modern set asked only for its coffee table\n";
+    {
+        const LazyFurnitureSet lazySet(FurnitureFactoryRegistry::get(FurnitureStyle::Modern));
+        std::cout<<lazySet.coffeeTable().coffeeOnMe();
+        std::cout<<"chair made: "<<(lazySet.hasChair() ? "yes" : "no")
+                 <<", sofa made: "<<(lazySet.hasSofa() ? "yes" : "no")<<"\n";
+    }
+
+    std::cout<<"\nTesting the Rustic style loaded from configuration\n";
+    const FurnitureStyleTable styleTable(rusticStyleConfig);
+    if (const DataDrivenStyle* rustic = styleTable.find("RUSTIC")) {
+        const DataDrivenFurnitureFactory rusticFactory(*rustic);
+        ClientCode(rusticFactory);
+        const ProductPtr<Chair> rusticChair = rusticFactory.makeChair();
+        std::cout<<ModernSofa().putAside(*rusticChair);
+    }
+
+    std::cout<<"\nTesting a default factory swapped from Victorian to ArtDeco\n";
+    {
+        FurnitureFactoryHandle defaultFactory(FurnitureFactoryRegistry::get(FurnitureStyle::Victorian));
+        ClientCode(*defaultFactory.read());
+        defaultFactory.publish(std::make_unique<ArtDecoFurnitureFactory>());
+        ClientCode(*defaultFactory.read());
+    }
+
+    std::cout<<"\nTesting a factory resolved from the request string \"Victorian\"\n";
+    if (const FurnitureFactory* factory = FurnitureFactoryRegistry::find("Victorian")) {
+        ClientCode(*factory);
+    }
+
+#ifdef DESIGN_PATTERNS_INSTRUMENTATION
+    std::cout<<"\nInstrumentation snapshot\n";
+    Instrumentation::snapshot().print(std::cout);
+#endif
     return 0;
 }
\ No newline at end of file
@@ -1,57 +1,1223 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <charconv>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <latch>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <semaphore>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//A lazily started coroutine producing a T. It starts when awaited and resumes its awaiter
+//once it is done, so chains of Tasks run without blocking any thread. syncWait() drives
+//a Task to completion from ordinary code and whenAll() keeps many Tasks in flight at once.
+template <typename T>
+class Task {
+public:
+    struct promise_type {
+        std::optional<T> value;
+        std::exception_ptr error;
+        std::coroutine_handle<> continuation;
+
+        Task get_return_object() { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept {
+            struct ResumeAwaiter {
+                bool await_ready() noexcept { return false; }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> self) noexcept {
+                    const std::coroutine_handle<> continuation = self.promise().continuation;
+                    return continuation ? continuation : std::noop_coroutine();
+                }
+                void await_resume() noexcept { }
+            };
+            return ResumeAwaiter();
+        }
+        void return_value(T result) { value.emplace(std::move(result)); }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) { }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+    T await_resume() {
+        if (handle_.promise().error) {
+            std::rethrow_exception(handle_.promise().error);
+        }
+        return std::move(*handle_.promise().value);
+    }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) { }
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+//A coroutine that starts at once and cleans up after itself, for the helpers below
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+template <typename T>
+DetachedTask signalWhenDone(Task<T>& task, std::optional<T>& result, std::exception_ptr& error,
+                            std::binary_semaphore& done) {
+    try {
+        result.emplace(co_await task);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    done.release();
+}
+
+//Blocks the calling thread until the task is done, whichever thread finishes it
+template <typename T>
+T syncWait(Task<T> task) {
+    std::optional<T> result;
+    std::exception_ptr error;
+    std::binary_semaphore done(0);
+    signalWhenDone(task, result, error, done);
+    done.acquire();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    return std::move(*result);
+}
+
+template <typename T>
+struct WhenAllState {
+    std::vector<std::optional<T>> results;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    std::atomic<std::size_t> remaining {0};
+    std::coroutine_handle<> continuation;
+};
+
+template <typename T>
+DetachedTask completeInto(Task<T> task, WhenAllState<T>& state, std::size_t index) {
+    try {
+        state.results[index].emplace(co_await task);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(state.errorMutex);
+        if (!state.error) {
+            state.error = std::current_exception();
+        }
+    }
+    if (state.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        state.continuation.resume();
+    }
+}
+
+//Starts every task at once and completes when the last one does, with the results in input order
+template <typename T>
+Task<std::vector<T>> whenAll(std::vector<Task<T>> tasks) {
+    WhenAllState<T> state;
+    state.results.resize(tasks.size());
+    //One extra count for the starter, so the last task cannot resume us before we suspended
+    state.remaining.store(tasks.size() + 1);
+    struct StartAll {
+        WhenAllState<T>& state;
+        std::vector<Task<T>>& tasks;
+        bool await_ready() noexcept { return false; }
+        bool await_suspend(std::coroutine_handle<> awaiter) {
+            state.continuation = awaiter;
+            for (std::size_t i = 0; i < tasks.size(); ++i) {
+                completeInto(std::move(tasks[i]), state, i);
+            }
+            return state.remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+        }
+        void await_resume() noexcept { }
+    };
+    co_await StartAll{state, tasks};
+    if (state.error) {
+        std::rethrow_exception(state.error);
+    }
+    std::vector<T> results;
+    results.reserve(state.results.size());
+    for (std::optional<T>& result : state.results) {
+        results.push_back(std::move(*result));
+    }
+    co_return results;
+}
+
+//Building with -DDESIGN_PATTERNS_SEALED marks every concrete transport and logistics final,
+//so wherever the concrete type is visible the compiler can devirtualize the calls.
+//The default build leaves the hierarchy open for extension.
+#ifdef DESIGN_PATTERNS_SEALED
+#define SEALED final
+#else
+#define SEALED
+#endif
+
+enum class TransportKind : std::uint8_t { Truck, Ship };
+constexpr std::size_t transportKindCount = 2;
+
+//Hot-path instrumentation, compiled in only with -DDESIGN_PATTERNS_INSTRUMENTATION.
+//Transport creations, by the factory methods, deliveries and delivery plans are counted per
+//transport kind, and planDelivery() calls, asynchronous ones up to their reply, are timed into
+//a log2 latency histogram. Each thread updates a block of counters of its own, so probes never
+//contend; snapshot() adds up the blocks of all threads, including threads that have already
+//exited. Without the define the probes compile to nothing.
+#ifdef DESIGN_PATTERNS_INSTRUMENTATION
+enum class Probe : std::uint8_t { CreateTransport, Deliver, PlanDelivery };
+
+class Instrumentation {
+public:
+    static constexpr std::size_t probeCount = 3;
+    static constexpr std::size_t latencyBuckets = 64;
+    static constexpr const char* probeNames[probeCount] = {"create_transport", "deliver", "plan_delivery"};
+
+    struct Snapshot {
+        std::uint64_t counts[transportKindCount][probeCount] = {};
+        //Bucket b counts the planDelivery() calls that took [2^b, 2^(b+1)) nanoseconds
+        std::uint64_t planDeliveryLatency[latencyBuckets] = {};
+
+        //One "name{labels} value" line per metric, ready to be scraped
+        void print(std::ostream& out) const {
+            static const char* const kindNames[transportKindCount] = {"truck", "ship"};
+            for (std::size_t kind = 0; kind < transportKindCount; ++kind) {
+                for (std::size_t probe = 0; probe < probeCount; ++probe) {
+                    out<<"logistics_calls_total{transport=\""<<kindNames[kind]<<"\",call=\""<<probeNames[probe]
+                       <<"\"} "<<counts[kind][probe]<<"\n";
+                }
+            }
+            for (std::size_t bucket = 0; bucket < latencyBuckets; ++bucket) {
+                if (planDeliveryLatency[bucket] != 0) {
+                    out<<"plan_delivery_latency_ns_bucket{lt=\""<<(std::uint64_t(1) << bucket) * 2<<"\"} "
+                       <<planDeliveryLatency[bucket]<<"\n";
+                }
+            }
+        }
+    };
+
+    static void count(TransportKind kind, Probe probe) {
+        increment(local().counts[static_cast<std::size_t>(kind)][static_cast<std::size_t>(probe)]);
+    }
+    static void recordPlanDeliveryLatency(std::chrono::nanoseconds latency) {
+        std::size_t bucket = 0;
+        for (auto ns = static_cast<std::uint64_t>(latency.count()); ns > 1 && bucket + 1 < latencyBuckets; ns >>= 1) {
+            ++bucket;
+        }
+        increment(local().planDeliveryLatency[bucket]);
+    }
+    static Snapshot snapshot() {
+        Registry& all = registry();
+        std::lock_guard<std::mutex> lock(all.mutex);
+        Snapshot result = all.retired;
+        for (const Block* block : all.live) {
+            addTo(result, *block);
+        }
+        return result;
+    }
+
+private:
+    struct Block {
+        std::atomic<std::uint64_t> counts[transportKindCount][probeCount] = {};
+        std::atomic<std::uint64_t> planDeliveryLatency[latencyBuckets] = {};
+    };
+    struct Registry {
+        std::mutex mutex;
+        std::vector<const Block*> live;
+        Snapshot retired;
+    };
+    //Registers the block of the thread and folds it into the retired totals when the thread exits
+    struct ThreadBlock {
+        Block block;
+        ThreadBlock() {
+            Registry& all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            all.live.push_back(&block);
+        }
+        ~ThreadBlock() {
+            Registry& all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            addTo(all.retired, block);
+            all.live.erase(std::find(all.live.begin(), all.live.end(), &block));
+        }
+    };
+
+    static Registry& registry() {
+        static Registry all;
+        return all;
+    }
+    static Block& local() {
+        thread_local ThreadBlock threadBlock;
+        return threadBlock.block;
+    }
+    //Only the owning thread writes a counter, so a plain load and store is enough
+    static void increment(std::atomic<std::uint64_t>& counter) {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    static void addTo(Snapshot& snapshot, const Block& block) {
+        for (std::size_t kind = 0; kind < transportKindCount; ++kind) {
+            for (std::size_t probe = 0; probe < probeCount; ++probe) {
+                snapshot.counts[kind][probe] += block.counts[kind][probe].load(std::memory_order_relaxed);
+            }
+        }
+        for (std::size_t bucket = 0; bucket < latencyBuckets; ++bucket) {
+            snapshot.planDeliveryLatency[bucket] += block.planDeliveryLatency[bucket].load(std::memory_order_relaxed);
+        }
+    }
+};
+
+//Times the enclosing scope into the planDelivery latency histogram
+class PlanDeliveryTimer {
+public:
+    PlanDeliveryTimer() : start_(std::chrono::steady_clock::now()) { }
+    ~PlanDeliveryTimer() {
+        Instrumentation::recordPlanDeliveryLatency(std::chrono::steady_clock::now() - start_);
+    }
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+#define LOGISTICS_PROBE(kind, probe) Instrumentation::count(kind, Probe::probe)
+#define LOGISTICS_TIME_PLAN_DELIVERY() const PlanDeliveryTimer planDeliveryTimer
+#else
+#define LOGISTICS_PROBE(kind, probe) ((void)0)
+#define LOGISTICS_TIME_PLAN_DELIVERY() ((void)0)
+#endif
+
+struct Order {
+    std::uint64_t id;
+    double distanceKm = 0.0;
+};
 
 //The Transport interface declares the "deliver" operation that all contrete Transport must implement
+//Thread safety: deliver() and deliverView() are const and must be safe to call
+//concurrently on the same object; Truck and Ship are stateless and trivially are.
 class Transport {
 public:
     virtual ~Transport() { }
     virtual std::string deliver() const = 0;
+    //Same message as deliver(), pointing to static storage instead of a new string
+    virtual std::string_view deliverView() const = 0;
+    //Asynchronous deliver(). Transports that call out to a carrier API override it and
+    //suspend until the reply arrives, so waiting for it does not hold a thread.
+    virtual Task<std::string> deliverAsync() const {
+        co_return deliver();
+    }
+    //What delivering the order would cost with this transport
+    virtual double cost(const Order& order) const = 0;
+    virtual TransportKind kind() const = 0;
 };
 
 //Concrete Products(Transports) provide various implementation of Product(Transport) interface
-class Truck : public Transport {
+class Truck SEALED : public Transport {
 public:
+    static constexpr std::string_view deliverMessage = "Delivering via Truck\n";
     std::string deliver() const override {
-        return "Delivering via Truck\n";
+        LOGISTICS_PROBE(TransportKind::Truck, Deliver);
+        return std::string(deliverMessage);
+    }
+    std::string_view deliverView() const override {
+        LOGISTICS_PROBE(TransportKind::Truck, Deliver);
+        return deliverMessage;
+    }
+    double cost(const Order& order) const override {
+        return 0.0 + 1.0 * order.distanceKm;
+    }
+    TransportKind kind() const override {
+        return TransportKind::Truck;
     }
 };
 
-class Ship : public Transport {
+class Ship SEALED : public Transport {
 public: 
+    static constexpr std::string_view deliverMessage = "Delivering via Ship\n";
     std::string deliver() const override {
-        return "Delivering via Ship\n";
+        LOGISTICS_PROBE(TransportKind::Ship, Deliver);
+        return std::string(deliverMessage);
+    }
+    std::string_view deliverView() const override {
+        LOGISTICS_PROBE(TransportKind::Ship, Deliver);
+        return deliverMessage;
+    }
+    double cost(const Order& order) const override {
+        return 500.0 + 0.2 * order.distanceKm;
+    }
+    TransportKind kind() const override {
+        return TransportKind::Ship;
     }
 };
 
+//A small lock-free pool of transports. Released transports are parked in a fixed
+//number of slots and handed out again by tryAcquire(), so a warmed-up pool never allocates.
+//A slot is emptied with a single exchange and filled with a single compare-exchange,
+//which keeps the pool free of the ABA problem of linked free lists.
+class TransportPool {
+public:
+    static constexpr std::size_t capacity = 16;
+
+    TransportPool() { }
+    TransportPool(const TransportPool&) = delete;
+    TransportPool& operator=(const TransportPool&) = delete;
+    ~TransportPool() {
+        for (std::atomic<Transport*>& slot : slots_) {
+            delete slot.exchange(nullptr);
+        }
+    }
+
+    //Returns a parked transport, or nullptr when the pool is empty
+    Transport* tryAcquire() {
+        for (std::atomic<Transport*>& slot : slots_) {
+            if (slot.load(std::memory_order_relaxed) != nullptr) {
+                if (Transport* transport = slot.exchange(nullptr, std::memory_order_acquire)) {
+                    return transport;
+                }
+            }
+        }
+        return nullptr;
+    }
+    //Parks the transport; returns false when every slot is taken and the caller keeps ownership
+    bool release(Transport* transport) {
+        for (std::atomic<Transport*>& slot : slots_) {
+            Transport* expected = nullptr;
+            if (slot.compare_exchange_strong(expected, transport, std::memory_order_release,
+                                             std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    std::atomic<Transport*> slots_[capacity] {};
+};
+
+//The transports parked by the current thread, for the PerThread policy. Every thread has
+//a cache of its own, so taking and parking a transport touches no shared cache line and
+//needs no atomics. A slot remembers the id of the Logistics the transport came from, and
+//ids are never reused, so a transport is only handed back to the Logistics that made it.
+//When every slot is taken the oldest transport is deleted to make room. A Logistics retires
+//its id when it is destroyed, and every cache deletes the transports of retired owners the
+//next time its thread uses it, so no transport is kept for long past its Logistics.
+//Transports released during thread exit, after the cache itself is gone, must not use the
+//PerThread policy.
+class ThreadTransportCache {
+public:
+    static constexpr std::size_t capacity = 8;
+
+    static ThreadTransportCache& local() {
+        thread_local ThreadTransportCache cache;
+        return cache;
+    }
+    ThreadTransportCache(const ThreadTransportCache&) = delete;
+    ThreadTransportCache& operator=(const ThreadTransportCache&) = delete;
+    ~ThreadTransportCache() {
+        for (const Slot& slot : slots_) {
+            delete slot.transport;
+        }
+    }
+
+    //Owners register their id before they park a transport, and retire it when they are destroyed
+    static void registerOwner(std::uint64_t owner) {
+        const std::lock_guard<std::mutex> lock(ownersMutex_);
+        owners_.push_back(owner);
+    }
+    static void retireOwner(std::uint64_t owner) {
+        {
+            const std::lock_guard<std::mutex> lock(ownersMutex_);
+            owners_.erase(std::find(owners_.begin(), owners_.end(), owner));
+        }
+        retired_.fetch_add(1, std::memory_order_release);
+    }
+
+    //Returns a transport parked for the owner, or nullptr when there is none
+    Transport* tryAcquire(std::uint64_t owner) {
+        dropRetired();
+        for (Slot& slot : slots_) {
+            if (slot.owner == owner && slot.transport != nullptr) {
+                return std::exchange(slot.transport, nullptr);
+            }
+        }
+        return nullptr;
+    }
+    void release(std::uint64_t owner, Transport* transport) {
+        dropRetired();
+        Slot* free = nullptr;
+        for (Slot& slot : slots_) {
+            if (slot.transport == nullptr) {
+                free = &slot;
+                break;
+            }
+        }
+        if (free == nullptr) {
+            free = &slots_[next_];
+            next_ = (next_ + 1) % capacity;
+            delete free->transport;
+        }
+        *free = Slot{owner, transport};
+    }
+
+private:
+    ThreadTransportCache() { }
+
+    struct Slot {
+        std::uint64_t owner = 0;
+        Transport* transport = nullptr;
+    };
+
+    //Unless an owner retired since the last look, this is a single load of a rarely written counter
+    void dropRetired() {
+        const std::uint64_t retired = retired_.load(std::memory_order_acquire);
+        if (retired == seenRetired_) {
+            return;
+        }
+        seenRetired_ = retired;
+        const std::lock_guard<std::mutex> lock(ownersMutex_);
+        for (Slot& slot : slots_) {
+            if (slot.transport != nullptr && std::find(owners_.begin(), owners_.end(), slot.owner) == owners_.end()) {
+                delete std::exchange(slot.transport, nullptr);
+            }
+        }
+    }
+
+    static inline std::mutex ownersMutex_;
+    static inline std::vector<std::uint64_t> owners_;
+    static inline std::atomic<std::uint64_t> retired_ {0};
+
+    Slot slots_[capacity];
+    std::size_t next_ = 0;
+    std::uint64_t seenRetired_ = 0;
+};
+
+//A work-stealing thread pool. Every worker owns a queue: it takes tasks from the front
+//of its own queue and, when that runs dry, steals from the back of the others.
+//Tasks must not block waiting for other tasks of the same pool.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(std::size_t threads = std::max(1u, std::thread::hardware_concurrency())) {
+        for (std::size_t i = 0; i < threads; ++i) {
+            workers_.push_back(std::make_unique<Worker>());
+        }
+        for (std::size_t i = 0; i < threads; ++i) {
+            threads_.emplace_back([this, i] { run(i); });
+        }
+    }
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    std::size_t size() const { return workers_.size(); }
+
+    void submit(std::function<void()> task) {
+        Worker& worker = *workers_[next_.fetch_add(1, std::memory_order_relaxed) % workers_.size()];
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.tasks.push_back(std::move(task));
+        }
+        pending_.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+        }
+        wake_.notify_one();
+    }
+
+    //The process-wide pool, sized to the hardware
+    static WorkStealingPool& shared() {
+        static WorkStealingPool pool;
+        return pool;
+    }
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool tryTake(std::size_t self, std::function<void()>& task) {
+        {
+            Worker& own = *workers_[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.front());
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        for (std::size_t i = 1; i < workers_.size(); ++i) {
+            Worker& victim = *workers_[(self + i) % workers_.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.back());
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(std::size_t self) {
+        std::function<void()> task;
+        while (true) {
+            if (tryTake(self, task)) {
+                pending_.fetch_sub(1);
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            wake_.wait(lock, [this] { return stopping_ || pending_.load() > 0; });
+            if (stopping_ && pending_.load() == 0) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<std::size_t> next_ {0};
+    std::atomic<std::size_t> pending_ {0};
+    std::mutex sleepMutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+};
+
+//Splits [0, count) into chunks, runs body(begin, end) for each chunk on the pool and waits
+//for all of them. The first exception thrown by a chunk is rethrown to the caller.
+//Must not be called from a task running on the same pool.
+template <typename Body>
+void parallelFor(WorkStealingPool& pool, std::size_t count, Body body) {
+    if (count == 0) {
+        return;
+    }
+    const std::size_t chunk = std::max<std::size_t>(1, count / (pool.size() * 4));
+    const std::size_t chunks = (count + chunk - 1) / chunk;
+    std::latch done(static_cast<std::ptrdiff_t>(chunks));
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    for (std::size_t begin = 0; begin < count; begin += chunk) {
+        const std::size_t end = std::min(count, begin + chunk);
+        pool.submit([&, begin, end] {
+            try {
+                body(begin, end);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            done.count_down();
+        });
+    }
+    done.wait();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+//InlinePoly keeps one object of any class derived from Base in a buffer of N bytes
+//inside itself and hands it out through the Base interface, like the small buffer
+//of std::function. Transports are tiny, so one held this way stays on the stack.
+template <typename Base, std::size_t N>
+class InlinePoly {
+public:
+    InlinePoly() { }
+    InlinePoly(const InlinePoly&) = delete;
+    InlinePoly& operator=(const InlinePoly&) = delete;
+    ~InlinePoly() { reset(); }
+
+    template <typename Concrete, typename... Args>
+    Concrete& emplace(Args&&... args) {
+        static_assert(std::is_base_of<Base, Concrete>::value, "InlinePoly only holds classes derived from Base");
+        static_assert(sizeof(Concrete) <= N, "the object does not fit into the InlinePoly buffer");
+        static_assert(alignof(Concrete) <= alignof(std::max_align_t), "the object is over-aligned");
+        reset();
+        Concrete* object = new (storage_) Concrete(std::forward<Args>(args)...);
+        object_ = object;
+        return *object;
+    }
+    void reset() {
+        if (object_ != nullptr) {
+            object_->~Base();
+            object_ = nullptr;
+        }
+    }
+    Base* get() const { return object_; }
+    Base& operator*() const { return *object_; }
+    Base* operator->() const { return object_; }
+    explicit operator bool() const { return object_ != nullptr; }
+
+private:
+    alignas(std::max_align_t) unsigned char storage_[N];
+    Base* object_ = nullptr;
+};
+
+using InlineTransport = InlinePoly<Transport, 2 * sizeof(void*)>;
+
+//Deleter matched to where a transport came from: back to its pool, when it has one
+//with a free slot, untouched when it is shared, into the cache of the releasing thread
+//when it has an owner id there, and deleted otherwise.
+struct TransportDeleter {
+    TransportPool* pool = nullptr;
+    bool shared = false;
+    std::uint64_t threadCacheOwner = 0;
+    void operator()(Transport* transport) const {
+        if (shared || (pool != nullptr && pool->release(transport))) {
+            return;
+        }
+        if (threadCacheOwner != 0) {
+            ThreadTransportCache::local().release(threadCacheOwner, transport);
+            return;
+        }
+        delete transport;
+    }
+};
+using TransportPtr = std::unique_ptr<Transport, TransportDeleter>;
+
+//Where ClientCode writes its output. A sink can coalesce the many small messages of
+//many runs into a few large writes, instead of one stream insertion per message.
+class OutputSink {
+public:
+    virtual ~OutputSink() { }
+    virtual void write(std::string_view text) = 0;
+    virtual void flush() { }
+};
+
+//Writes every message straight to a stream, like the plain ClientCode does
+class StreamSink : public OutputSink {
+public:
+    explicit StreamSink(std::ostream& stream) : stream_(stream) { }
+    void write(std::string_view text) override {
+        stream_.write(text.data(), static_cast<std::streamsize>(text.size()));
+    }
+    void flush() override {
+        stream_.flush();
+    }
+
+private:
+    std::ostream& stream_;
+};
+
+//Collects messages in a buffer of its own and hands them to the file once the buffer is
+//full, so the file sees one large write per capacity bytes. Flushes when destroyed.
+class BufferedSink : public OutputSink {
+public:
+    explicit BufferedSink(std::FILE* file, std::size_t capacity = 64 * 1024) : file_(file), capacity_(capacity) {
+        buffer_.reserve(capacity_);
+    }
+    BufferedSink(const BufferedSink&) = delete;
+    BufferedSink& operator=(const BufferedSink&) = delete;
+    ~BufferedSink() override {
+        flush();
+    }
+    void write(std::string_view text) override {
+        if (buffer_.size() + text.size() > capacity_) {
+            drain();
+        }
+        if (text.size() >= capacity_) {
+            std::fwrite(text.data(), 1, text.size(), file_);
+            return;
+        }
+        buffer_.append(text);
+    }
+    void flush() override {
+        drain();
+        std::fflush(file_);
+    }
+
+private:
+    void drain() {
+        if (!buffer_.empty()) {
+            std::fwrite(buffer_.data(), 1, buffer_.size(), file_);
+            buffer_.clear();
+        }
+    }
+
+    std::FILE* file_;
+    std::size_t capacity_;
+    std::string buffer_;
+};
+
+//Hands every message to a user-supplied callback, e.g. one that queues it on a socket
+class CallbackSink : public OutputSink {
+public:
+    explicit CallbackSink(std::function<void(std::string_view)> callback) : callback_(std::move(callback)) { }
+    void write(std::string_view text) override {
+        callback_(text);
+    }
+
+private:
+    std::function<void(std::string_view)> callback_;
+};
+
+//How Logistics gets the transport used by planDelivery():
+//PerCall - the Factory Method creates a new transport for every delivery,
+//Cached  - a single transport is created on first use and reused, for stateless transports,
+//Pooled  - transports are taken from and returned to a TransportPool, for stateful transports,
+//Inline  - like PerCall, but planDelivery() creates the transport on the stack in an InlineTransport,
+//PerThread - like Pooled, but every thread parks transports in a ThreadTransportCache of its own,
+//            so threads never share a pool. A transport released on another thread than the one
+//            it was taken on is parked there, and is deleted after the Logistics is destroyed,
+//            once that thread next uses its cache. Placement per NUMA node is left to the OS, which
+//            first-touch allocates the cache on the node of its thread.
+enum class TransportPolicy { PerCall, Cached, Pooled, Inline, PerThread };
+
 //The Creator(Logistics) class declares factory method that is supposed to to
 //return an object of Product(Transport) class. The Creator's(Logistics) subclasses
 //provide the implementation of this method
+//Thread safety: all const members of Logistics may be called concurrently from any
+//number of threads, whatever the TransportPolicy, as long as createTransport() is
+//safe to call concurrently too (it is for RoadLogistics and ShipLogistics).
 class Logistics {
 public: 
-    virtual ~Logistics() { }
+    explicit Logistics(TransportPolicy policy = TransportPolicy::PerCall)
+        : policy_(policy), id_(nextId_.fetch_add(1, std::memory_order_relaxed)), cached_(nullptr) {
+        if (policy_ == TransportPolicy::PerThread) {
+            ThreadTransportCache::registerOwner(id_);
+        }
+    }
+    Logistics(const Logistics&) = delete;
+    Logistics& operator=(const Logistics&) = delete;
+    virtual ~Logistics() {
+        if (policy_ == TransportPolicy::PerThread) {
+            ThreadTransportCache::retireOwner(id_);
+        }
+        delete cached_.load();
+    }
     virtual Transport* createTransport() const = 0; // Factory Method
+    //Same Factory Method, constructing the transport into the holder, which owns it from then on
+    virtual Transport& createTransport(InlineTransport& holder) const = 0;
     std::string planDelivery() const {
-        //calling Facotry Method to create a Product object
-        Transport* transport = this->createTransport();
-        std::string result = "The order is " + transport->deliver();
-        delete transport;
+        std::string result;
+        planDelivery(result);
         return result;
     }
+    //Appends the plan to out. With the Cached and Pooled policies nothing is allocated
+    //in steady state, as long as out has room for the message.
+    void planDelivery(std::string& out) const {
+        withTransport([&out](const Transport& transport) {
+            out.append(deliveryPrefix);
+            out.append(transport.deliverView());
+        });
+    }
+    //Writes the plan to the sink, without building a string
+    void planDelivery(OutputSink& sink) const {
+        withTransport([&sink](const Transport& transport) {
+            sink.write(deliveryPrefix);
+            sink.write(transport.deliverView());
+        });
+    }
+    //Asynchronous planDelivery(). The transport is held for the whole wait,
+    //so with the Pooled policy it only goes back to the pool after the reply, and the
+    //latency recorded includes the wait.
+    Task<std::string> planDeliveryAsync() const {
+        LOGISTICS_TIME_PLAN_DELIVERY();
+        const TransportPtr transport = makeTransport();
+        LOGISTICS_PROBE(transport->kind(), PlanDelivery);
+        std::string result(deliveryPrefix);
+        result += co_await transport->deliverAsync();
+        co_return result;
+    }
+    //Gets a transport according to the policy. The deleter knows where it came from:
+    //a pooled transport goes back to its pool or thread cache, the cached one is left alone
+    //and a transport of its own is deleted. An owning pointer cannot point into the stack,
+    //so the Inline policy gets one from the heap here.
+    TransportPtr makeTransport() const {
+        switch (policy_) {
+        case TransportPolicy::Cached:
+            return TransportPtr(cachedTransport(), TransportDeleter{nullptr, true});
+        case TransportPolicy::Pooled: {
+            Transport* transport = pool_.tryAcquire();
+            if (transport == nullptr) {
+                transport = this->createTransport();
+            }
+            return TransportPtr(transport, TransportDeleter{&pool_, false});
+        }
+        case TransportPolicy::PerThread: {
+            Transport* transport = ThreadTransportCache::local().tryAcquire(id_);
+            if (transport == nullptr) {
+                transport = this->createTransport();
+            }
+            return TransportPtr(transport, TransportDeleter{nullptr, false, id_});
+        }
+        case TransportPolicy::PerCall:
+        case TransportPolicy::Inline:
+            break;
+        }
+        //calling Facotry Method to create a Product object
+        return TransportPtr(this->createTransport());
+    }
+    //Appends the plan of a single order, prefixed with the order id, to out
+    void planDelivery(const Order& order, std::string& out) const {
+        withTransport([&order, &out](const Transport& transport) { planDelivery(order, transport, out); });
+    }
+    //Appends the plan of the order with a transport the caller already has
+    static void planDelivery(const Order& order, const Transport& transport, std::string& out) {
+        char id[24];
+        const auto converted = std::to_chars(id, id + sizeof(id), order.id);
+        out.append("Order #");
+        out.append(id, converted.ptr);
+        out.append(": ");
+        out.append(deliveryPrefix);
+        out.append(transport.deliverView());
+    }
+    //Plans every order on the pool and returns the plans in input order.
+    //Must not be called from a task running on the same pool.
+    std::vector<std::string> planDeliveries(std::span<const Order> orders, WorkStealingPool& pool) const {
+        std::vector<std::string> results(orders.size());
+        parallelFor(pool, orders.size(), [&](std::size_t begin, std::size_t end) {
+            for (std::size_t i = begin; i < end; ++i) {
+                planDelivery(orders[i], results[i]);
+            }
+        });
+        return results;
+    }
+    std::vector<std::string> planDeliveries(std::span<const Order> orders) const {
+        return planDeliveries(orders, WorkStealingPool::shared());
+    }
+    TransportPolicy policy() const { return policy_; }
     //other usefull functions for Logistics
+
+private:
+    static constexpr std::string_view deliveryPrefix = "The order is ";
+
+    //Calls use(transport) with a transport obtained according to the policy
+    template <typename Use>
+    void withTransport(Use use) const {
+        LOGISTICS_TIME_PLAN_DELIVERY();
+        if (policy_ == TransportPolicy::Inline) {
+            InlineTransport holder;
+            const Transport& transport = this->createTransport(holder);
+            LOGISTICS_PROBE(transport.kind(), PlanDelivery);
+            use(transport);
+            return;
+        }
+        const TransportPtr transport = makeTransport();
+        LOGISTICS_PROBE(transport->kind(), PlanDelivery);
+        use(*transport);
+    }
+    //Creates the shared transport on first use; if two threads race, one of them drops its copy
+    Transport* cachedTransport() const {
+        Transport* transport = cached_.load(std::memory_order_acquire);
+        if (transport == nullptr) {
+            Transport* created = this->createTransport();
+            if (cached_.compare_exchange_strong(transport, created, std::memory_order_acq_rel,
+                                                std::memory_order_acquire)) {
+                transport = created;
+            } else {
+                delete created;
+            }
+        }
+        return transport;
+    }
+
+    //Ids tag the transports in the thread caches; 0 is never given out
+    static inline std::atomic<std::uint64_t> nextId_ {1};
+
+    const TransportPolicy policy_;
+    const std::uint64_t id_;
+    mutable std::atomic<Transport*> cached_;
+    mutable TransportPool pool_;
 };
 
 //Concrete Logistics override the factory method in order to change the delivery type
-class RoadLogistics : public Logistics {
+class RoadLogistics SEALED : public Logistics {
 public:
+    using Logistics::Logistics;
     Transport* createTransport() const override {
+        LOGISTICS_PROBE(TransportKind::Truck, CreateTransport);
         return new Truck;
     }
+    Transport& createTransport(InlineTransport& holder) const override {
+        LOGISTICS_PROBE(TransportKind::Truck, CreateTransport);
+        return holder.emplace<Truck>();
+    }
 };
 
-class ShipLogistics : public Logistics {
+class ShipLogistics SEALED : public Logistics {
 public:
+    using Logistics::Logistics;
     Transport* createTransport() const override {
+        LOGISTICS_PROBE(TransportKind::Ship, CreateTransport);
         return new Ship;
     }
+    Transport& createTransport(InlineTransport& holder) const override {
+        LOGISTICS_PROBE(TransportKind::Ship, CreateTransport);
+        return holder.emplace<Ship>();
+    }
+};
+
+//A composite over several Logistics that plans each order with the cheapest of them.
+//All modes are evaluated in one pass over the batch, and each mode provides a single
+//transport for the whole batch (or for each chunk, when planning in parallel)
+//instead of creating and deleting one per order.
+class MultiModalLogistics {
+public:
+    struct Plan {
+        const Logistics* logistics;
+        double cost;
+        std::string plan;
+    };
+
+    explicit MultiModalLogistics(std::vector<const Logistics*> modes) : modes_(std::move(modes)) {
+        if (modes_.empty()) {
+            throw std::invalid_argument("MultiModalLogistics needs at least one Logistics");
+        }
+    }
+
+    std::vector<Plan> planBest(std::span<const Order> orders) const {
+        std::vector<Plan> results(orders.size());
+        planRange(orders, 0, orders.size(), results);
+        return results;
+    }
+    //Same, with the batch split into chunks planned on the pool.
+    //Must not be called from a task running on the same pool.
+    std::vector<Plan> planBest(std::span<const Order> orders, WorkStealingPool& pool) const {
+        std::vector<Plan> results(orders.size());
+        parallelFor(pool, orders.size(), [&](std::size_t begin, std::size_t end) {
+            planRange(orders, begin, end, results);
+        });
+        return results;
+    }
+
+private:
+    void planRange(std::span<const Order> orders, std::size_t begin, std::size_t end, std::vector<Plan>& results) const {
+        std::vector<TransportPtr> transports;
+        transports.reserve(modes_.size());
+        for (const Logistics* mode : modes_) {
+            transports.push_back(mode->makeTransport());
+        }
+        for (std::size_t i = begin; i < end; ++i) {
+            std::size_t best = 0;
+            double bestCost = transports[0]->cost(orders[i]);
+            for (std::size_t mode = 1; mode < transports.size(); ++mode) {
+                const double cost = transports[mode]->cost(orders[i]);
+                if (cost < bestCost) {
+                    best = mode;
+                    bestCost = cost;
+                }
+            }
+            Plan& result = results[i];
+            result.logistics = modes_[best];
+            result.cost = bestCost;
+            result.plan.clear();
+            Logistics::planDelivery(orders[i], *transports[best], result.plan);
+        }
+    }
+
+    std::vector<const Logistics*> modes_;
+};
+
+//When an OrderBatcher hands the orders of one kind to its Logistics: on reaching batchSize
+//orders, or once the oldest of them has waited maxDelay. capacity bounds the queue.
+struct OrderBatchLimits {
+    std::size_t batchSize = 64;
+    std::chrono::microseconds maxDelay {1000};
+    std::size_t capacity = 4096;
+};
+
+//A batching stage in front of Logistics. Any number of threads submit orders, each tagged
+//with the transport kind it goes by, into one bounded queue. A single thread of the batcher
+//drains the queue, groups the orders by kind and plans every group as a batch, with one
+//transport for the whole batch, so the fixed cost of a plan is paid per batch instead of
+//per order. Batches are passed to flush on the batcher thread, with orders and plans in
+//submission order; the spans are only valid during the call. flush may call close(), which
+//then returns without waiting for the batcher thread, but must not destroy the batcher.
+class OrderBatcher {
+public:
+    using Flush = std::function<void(TransportKind kind, std::span<const Order> orders, std::span<const std::string> plans)>;
+
+    //truck plans the Truck orders, ship the Ship orders; both must outlive the batcher
+    OrderBatcher(const Logistics& truck, const Logistics& ship, Flush flush, OrderBatchLimits limits = {})
+        : planners_{&truck, &ship}, flush_(std::move(flush)), limits_(limits), ring_(limits.capacity) {
+        if (limits_.batchSize == 0 || limits_.capacity == 0) {
+            throw std::invalid_argument("OrderBatcher needs a batch size and a capacity of at least one");
+        }
+        for (Batch& batch : batches_) {
+            batch.orders.reserve(limits_.batchSize);
+        }
+        thread_ = std::thread([this] { run(); });
+    }
+    OrderBatcher(const OrderBatcher&) = delete;
+    OrderBatcher& operator=(const OrderBatcher&) = delete;
+    ~OrderBatcher() {
+        close();
+    }
+
+    //Waits while the queue is full. Returns false, dropping the order, once the batcher is closed.
+    bool submit(TransportKind kind, const Order& order) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this] { return closed_ || count_ < ring_.size(); });
+        return push(lock, kind, order);
+    }
+    //Same, but returns false at once when the queue is full
+    bool trySubmit(TransportKind kind, const Order& order) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (count_ == ring_.size()) {
+            return false;
+        }
+        return push(lock, kind, order);
+    }
+    //Stops taking orders, flushes every order taken so far and waits for the batcher thread,
+    //unless it is called by flush on that thread, which would then wait for itself
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        notEmpty_.notify_one();
+        notFull_.notify_all();
+        if (thread_.joinable() && thread_.get_id() != std::this_thread::get_id()) {
+            thread_.join();
+        }
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        Order order;
+        TransportKind kind;
+        Clock::time_point submitted;
+    };
+    //The orders of one kind waiting for their batch, only touched by the batcher thread
+    struct Batch {
+        std::vector<Order> orders;
+        Clock::time_point oldest;
+        std::vector<std::string> plans;
+    };
+
+    bool push(std::unique_lock<std::mutex>& lock, TransportKind kind, const Order& order) {
+        if (closed_) {
+            return false;
+        }
+        ring_[(head_ + count_) % ring_.size()] = Entry{order, kind, Clock::now()};
+        ++count_;
+        lock.unlock();
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    void run() {
+        std::vector<Entry> drained;
+        drained.reserve(ring_.size());
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            if (count_ == 0 && !closed_) {
+                std::optional<Clock::time_point> deadline;
+                for (const Batch& batch : batches_) {
+                    if (!batch.orders.empty() && (!deadline || batch.oldest + limits_.maxDelay < *deadline)) {
+                        deadline = batch.oldest + limits_.maxDelay;
+                    }
+                }
+                if (deadline) {
+                    notEmpty_.wait_until(lock, *deadline);
+                } else {
+                    notEmpty_.wait(lock);
+                }
+            }
+            for (; count_ > 0; --count_) {
+                drained.push_back(ring_[head_]);
+                head_ = (head_ + 1) % ring_.size();
+            }
+            const bool closing = closed_;
+            lock.unlock();
+            notFull_.notify_all();
+
+            for (const Entry& entry : drained) {
+                Batch& batch = batches_[static_cast<std::size_t>(entry.kind)];
+                if (batch.orders.empty()) {
+                    batch.oldest = entry.submitted;
+                }
+                batch.orders.push_back(entry.order);
+                if (batch.orders.size() == limits_.batchSize) {
+                    flush(entry.kind);
+                }
+            }
+            drained.clear();
+            const Clock::time_point now = Clock::now();
+            for (std::size_t kind = 0; kind < transportKindCount; ++kind) {
+                Batch& batch = batches_[kind];
+                if (!batch.orders.empty() && (closing || now - batch.oldest >= limits_.maxDelay)) {
+                    flush(static_cast<TransportKind>(kind));
+                }
+            }
+            //Nothing can be submitted once closed, so the queue drained above was the last
+            if (closing) {
+                return;
+            }
+            lock.lock();
+        }
+    }
+
+    void flush(TransportKind kind) {
+        Batch& batch = batches_[static_cast<std::size_t>(kind)];
+        if (batch.plans.size() < batch.orders.size()) {
+            batch.plans.resize(batch.orders.size());
+        }
+        {
+            const TransportPtr transport = planners_[static_cast<std::size_t>(kind)]->makeTransport();
+            for (std::size_t i = 0; i < batch.orders.size(); ++i) {
+                batch.plans[i].clear();
+                Logistics::planDelivery(batch.orders[i], *transport, batch.plans[i]);
+            }
+        }
+        flush_(kind, batch.orders, std::span<const std::string>(batch.plans.data(), batch.orders.size()));
+        batch.orders.clear();
+    }
+
+    const Logistics* const planners_[transportKindCount];
+    const Flush flush_;
+    const OrderBatchLimits limits_;
+
+    std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    std::vector<Entry> ring_;
+    std::size_t head_ = 0;
+    std::size_t count_ = 0;
+    bool closed_ = false;
+
+    Batch batches_[transportKindCount];
+    std::thread thread_;
 };
 
 //Client is not aware of the Logistics class        
@@ -59,8 +1225,712 @@ void ClientCode(const Logistics& logictics) {
     std::cout<<logictics.planDelivery();
 }
 
-int main()
+//Same, written to a sink
+void ClientCode(const Logistics& logictics, OutputSink& sink) {
+    logictics.planDelivery(sink);
+}
+
+//Benchmarks: run the program with --bench.
+//Every benchmark reports the time, the number of heap allocations and the bytes
+//allocated per operation. The global operator new is replaced so that allocations made
+//inside the standard library are counted too.
+std::atomic<std::size_t> allocationCount {0};
+std::atomic<std::size_t> allocatedBytes {0};
+
+void* operator new(std::size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+//Types aligned beyond max_align_t, such as the cache-line aligned ones, come through here
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    const auto align = static_cast<std::size_t>(alignment);
+#ifdef _MSC_VER
+    if (void* memory = _aligned_malloc(size == 0 ? 1 : size, align)) {
+        return memory;
+    }
+#else
+    //aligned_alloc wants the size to be a multiple of the alignment
+    if (void* memory = std::aligned_alloc(align, ((size == 0 ? 1 : size) + align - 1) / align * align)) {
+        return memory;
+    }
+#endif
+    throw std::bad_alloc();
+}
+//GCC cannot tell that the replaced operator new above pairs with these deletes
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+void operator delete(void* memory, std::align_val_t) noexcept {
+#ifdef _MSC_VER
+    _aligned_free(memory);
+#else
+    std::free(memory);
+#endif
+}
+void operator delete(void* memory, std::size_t, std::align_val_t alignment) noexcept {
+    operator delete(memory, alignment);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+//Swallows everything written to it, so ClientCode can be measured without a terminal
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+std::FILE* openNullDevice() {
+#ifdef _WIN32
+    return std::fopen("NUL", "wb");
+#else
+    return std::fopen("/dev/null", "wb");
+#endif
+}
+
+//body(iterations) performs the operation iterations times and returns a checksum
+//of the results, which keeps the compiler from dropping the work.
+template <typename Body>
+void runBenchmark(const std::string& name, std::size_t iterations, Body body) {
+    const std::size_t allocationsBefore = allocationCount.load();
+    const std::size_t bytesBefore = allocatedBytes.load();
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t checksum = body(iterations);
+    const auto stop = std::chrono::steady_clock::now();
+    const double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    const double allocations = static_cast<double>(allocationCount.load() - allocationsBefore);
+    const double bytes = static_cast<double>(allocatedBytes.load() - bytesBefore);
+    std::cout<<std::left<<std::setw(40)<<name<<std::right<<std::fixed<<std::setprecision(1)
+             <<std::setw(10)<<ns / iterations<<" ns/op"
+             <<std::setw(8)<<allocations / iterations<<" allocs/op"
+             <<std::setw(9)<<bytes / iterations<<" bytes/op"
+             <<"  (checksum "<<checksum<<")\n";
+}
+
+//createTransport, deliver and ClientCode of one Logistics, plus planDelivery under every policy
+template <typename ConcreteLogistics>
+void runLogisticsBenchmarks(const std::string& name, std::size_t count) {
+    const ConcreteLogistics logistics;
+    runBenchmark(name + "/createTransport", count, [&logistics](std::size_t n) {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            const Transport* transport = logistics.createTransport();
+            checksum += transport != nullptr;
+            delete transport;
+        }
+        return checksum;
+    });
+    const std::unique_ptr<const Transport> transport(logistics.createTransport());
+    runBenchmark(name + "/deliver", count, [&transport](std::size_t n) {
+        std::size_t checksum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            checksum += transport->deliver().size();
+        }
+        return checksum;
+    });
+    runBenchmark(name + "/ClientCode", count, [&logistics](std::size_t n) {
+        NullBuffer nullBuffer;
+        std::streambuf* const console = std::cout.rdbuf(&nullBuffer);
+        for (std::size_t i = 0; i < n; ++i) {
+            ClientCode(logistics);
+        }
+        std::cout.rdbuf(console);
+        return n;
+    });
+
+    runBenchmark(name + "/ClientCode into BufferedSink", count, [&logistics](std::size_t n) {
+        std::FILE* const nullDevice = openNullDevice();
+        {
+            BufferedSink sink(nullDevice);
+            for (std::size_t i = 0; i < n; ++i) {
+                ClientCode(logistics, sink);
+            }
+        }
+        std::fclose(nullDevice);
+        return n;
+    });
+
+    const std::pair<const char*, TransportPolicy> policies[] = {
+        {"PerCall", TransportPolicy::PerCall}, {"Cached", TransportPolicy::Cached}, {"Pooled", TransportPolicy::Pooled},
+        {"Inline", TransportPolicy::Inline}, {"PerThread", TransportPolicy::PerThread}};
+    for (const auto& [policyName, policy] : policies) {
+        const ConcreteLogistics planner(policy);
+        runBenchmark(name + "/planDelivery/" + policyName, count, [&planner](std::size_t n) {
+            std::size_t checksum = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                checksum += planner.planDelivery().size();
+            }
+            return checksum;
+        });
+        runBenchmark(name + "/planDelivery into buffer/" + policyName, count, [&planner](std::size_t n) {
+            std::size_t checksum = 0;
+            std::string buffer;
+            buffer.reserve(256);
+            for (std::size_t i = 0; i < n; ++i) {
+                buffer.clear();
+                planner.planDelivery(buffer);
+                checksum += buffer.size();
+            }
+            return checksum;
+        });
+    }
+}
+
+//Keeps a benchmarked loop out of line, so the caller's knowledge of the dynamic type does not leak in
+#if defined(__GNUC__)
+#define BENCHMARK_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define BENCHMARK_NOINLINE __declspec(noinline)
+#else
+#define BENCHMARK_NOINLINE
+#endif
+
+//Creates count transports on the stack and collects their messages, through the Logistics
+//interface: createTransport() and deliverView() stay virtual calls in every build.
+BENCHMARK_NOINLINE std::size_t deliverViaInterface(const Logistics& logistics, std::size_t count) {
+    std::size_t checksum = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        InlineTransport holder;
+        const Transport& transport = logistics.createTransport(holder);
+        checksum += transport.deliverView().size();
+    }
+    return checksum;
+}
+
+//The same loop on the concrete logistics and transport. In a sealed build both calls are
+//resolved statically and inlined, so the loop may fold away entirely. In an open build a subclass
+//could still override them, so they stay virtual, although the compiler may guess the target
+//and check the guess at run time.
+template <typename ConcreteLogistics, typename ConcreteTransport>
+BENCHMARK_NOINLINE std::size_t deliverViaConcreteType(const ConcreteLogistics& logistics, std::size_t count) {
+    std::size_t checksum = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        InlineTransport holder;
+        const auto& transport = static_cast<const ConcreteTransport&>(logistics.createTransport(holder));
+        checksum += transport.deliverView().size();
+    }
+    return checksum;
+}
+
+template <typename ConcreteLogistics, typename ConcreteTransport>
+void runDevirtualizationBenchmarks(const std::string& name, std::size_t count) {
+    const ConcreteLogistics logistics(TransportPolicy::Inline);
+    runBenchmark(name + "/create+deliver via Logistics&", count, [&logistics](std::size_t n) {
+        return deliverViaInterface(logistics, n);
+    });
+    runBenchmark(name + "/create+deliver via concrete type", count, [&logistics](std::size_t n) {
+        return deliverViaConcreteType<ConcreteLogistics, ConcreteTransport>(logistics, n);
+    });
+}
+
+void runBenchmarks() {
+    const std::size_t count = 1000000;
+#ifdef DESIGN_PATTERNS_SEALED
+    std::cout<<"Sealed hierarchy: concrete classes are final\n";
+#else
+    std::cout<<"Open hierarchy: build with -DDESIGN_PATTERNS_SEALED to mark concrete classes final\n";
+#endif
+    runLogisticsBenchmarks<RoadLogistics>("Road", count);
+    runLogisticsBenchmarks<ShipLogistics>("Ship", count);
+    runDevirtualizationBenchmarks<RoadLogistics, Truck>("Road", count);
+    runDevirtualizationBenchmarks<ShipLogistics, Ship>("Ship", count);
+
+    const RoadLogistics road(TransportPolicy::Cached);
+    const ShipLogistics ship(TransportPolicy::Cached);
+    const MultiModalLogistics multiModal({&road, &ship});
+    std::vector<Order> orders;
+    orders.reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        orders.push_back(Order{i, static_cast<double>(i % 2000)});
+    }
+    //Every worker of the shared pool plans orders at once, so the policies differ in what they share
+    for (const TransportPolicy policy : {TransportPolicy::Pooled, TransportPolicy::PerThread}) {
+        const RoadLogistics planner(policy);
+        runBenchmark(std::string("Road/planDeliveries on all cores/") +
+                         (policy == TransportPolicy::Pooled ? "Pooled" : "PerThread"),
+                     count, [&](std::size_t) {
+                         std::size_t checksum = 0;
+                         for (const std::string& plan : planner.planDeliveries(orders)) {
+                             checksum += plan.size();
+                         }
+                         return checksum;
+                     });
+    }
+    runBenchmark("Road/planDelivery of one order at a time", count, [&](std::size_t) {
+        std::size_t checksum = 0;
+        std::string plan;
+        for (const Order& order : orders) {
+            plan.clear();
+            road.planDelivery(order, plan);
+            checksum += plan.size();
+        }
+        return checksum;
+    });
+    runBenchmark("OrderBatcher/4 producers, per order", count, [&](std::size_t) {
+        std::size_t checksum = 0;
+        {
+            OrderBatcher batcher(road, ship, [&checksum](TransportKind, std::span<const Order>, std::span<const std::string> plans) {
+                for (const std::string& plan : plans) {
+                    checksum += plan.size();
+                }
+            });
+            constexpr std::size_t producers = 4;
+            std::vector<std::thread> threads;
+            for (std::size_t p = 0; p < producers; ++p) {
+                threads.emplace_back([&, p] {
+                    for (std::size_t i = p; i < orders.size(); i += producers) {
+                        batcher.submit(orders[i].distanceKm < 600.0 ? TransportKind::Truck : TransportKind::Ship, orders[i]);
+                    }
+                });
+            }
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+        }
+        return checksum;
+    });
+    runBenchmark("MultiModal/planBest per order", count, [&](std::size_t) {
+        std::size_t checksum = 0;
+        for (const MultiModalLogistics::Plan& best : multiModal.planBest(orders)) {
+            checksum += best.plan.size();
+        }
+        return checksum;
+    });
+}
+
+//Allocation checks: run the program with --check-allocs.
+//Every check runs its body once to set up whatever is created lazily (the cached transport,
+//pools, stream buffers), then runs it again and fails if that allocated anything.
+//The program exits with a failure status if any check failed, so a build can run it
+//to catch per-call allocations creeping back into these paths.
+template <typename Body>
+bool checkNoAllocations(const std::string& name, Body body) {
+    constexpr std::size_t runs = 100;
+    body();
+    const std::size_t allocationsBefore = allocationCount.load();
+    for (std::size_t i = 0; i < runs; ++i) {
+        body();
+    }
+    const std::size_t allocations = allocationCount.load() - allocationsBefore;
+    std::cout<<std::left<<std::setw(44)<<name;
+    if (allocations == 0) {
+        std::cout<<"ok\n";
+    } else {
+        std::cout<<"FAILED: "<<allocations<<" allocations in "<<runs<<" runs\n";
+    }
+    return allocations == 0;
+}
+
+//PerCall makes a transport per delivery by design, so only the other policies are checked
+template <typename ConcreteLogistics>
+bool checkLogisticsAllocations(const std::string& name, std::FILE* nullDevice) {
+    bool passed = true;
+    const std::pair<const char*, TransportPolicy> policies[] = {
+        {"Cached", TransportPolicy::Cached}, {"Pooled", TransportPolicy::Pooled},
+        {"Inline", TransportPolicy::Inline}, {"PerThread", TransportPolicy::PerThread}};
+    for (const auto& [policyName, policy] : policies) {
+        const ConcreteLogistics logistics(policy);
+        std::string buffer;
+        buffer.reserve(256);
+        BufferedSink sink(nullDevice);
+        passed &= checkNoAllocations(name + "/planDelivery into buffer/" + policyName, [&] {
+            buffer.clear();
+            logistics.planDelivery(buffer);
+        });
+        passed &= checkNoAllocations(name + "/planDelivery of an order/" + policyName, [&] {
+            buffer.clear();
+            logistics.planDelivery(Order{42, 100.0}, buffer);
+        });
+        passed &= checkNoAllocations(name + "/ClientCode into BufferedSink/" + policyName,
+                                     [&] { ClientCode(logistics, sink); });
+    }
+    return passed;
+}
+
+int runAllocationChecks() {
+    std::FILE* const nullDevice = openNullDevice();
+    bool passed = true;
+    passed &= checkLogisticsAllocations<RoadLogistics>("Road", nullDevice);
+    passed &= checkLogisticsAllocations<ShipLogistics>("Ship", nullDevice);
+    std::fclose(nullDevice);
+    std::cout<<(passed ? "All allocation checks passed\n" : "Some allocation checks FAILED\n");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//Self checks: run the program with --self-check.
+//A carrier API stand-in for the asynchronous path. A request suspends the coroutine that
+//makes it, and the carrier's own thread resumes it with the reply once the latency has
+//passed, the way the completion thread of a network client would.
+class SimulatedCarrier {
+public:
+    explicit SimulatedCarrier(std::chrono::milliseconds latency) : latency_(latency), thread_([this] { run(); }) { }
+    SimulatedCarrier(const SimulatedCarrier&) = delete;
+    SimulatedCarrier& operator=(const SimulatedCarrier&) = delete;
+    //Every request must have been answered before the carrier is destroyed
+    ~SimulatedCarrier() {
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wakeUp_.notify_one();
+        thread_.join();
+    }
+
+    auto request(std::string_view reply) {
+        struct Reply {
+            SimulatedCarrier& carrier;
+            std::string_view reply;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> waiting) { carrier.park(waiting); }
+            std::string await_resume() const { return std::string(reply); }
+        };
+        return Reply{*this, reply};
+    }
+    //The most requests that were waiting for a reply at the same time
+    std::size_t peakInFlight() const {
+        const std::lock_guard<std::mutex> lock(mutex_);
+        return peakInFlight_;
+    }
+
+private:
+    struct Pending {
+        std::chrono::steady_clock::time_point due;
+        std::coroutine_handle<> waiting;
+    };
+
+    void park(std::coroutine_handle<> waiting) {
+        {
+            const std::lock_guard<std::mutex> lock(mutex_);
+            pending_.push_back(Pending{std::chrono::steady_clock::now() + latency_, waiting});
+            peakInFlight_ = std::max(peakInFlight_, pending_.size());
+        }
+        wakeUp_.notify_one();
+    }
+    //Requests are due in the order they arrive, so the front is always the next reply
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            wakeUp_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+            if (pending_.empty()) {
+                return;
+            }
+            const Pending next = pending_.front();
+            while (std::chrono::steady_clock::now() < next.due) {
+                wakeUp_.wait_until(lock, next.due);
+            }
+            pending_.pop_front();
+            lock.unlock();
+            next.waiting.resume();
+            lock.lock();
+        }
+    }
+
+    const std::chrono::milliseconds latency_;
+    mutable std::mutex mutex_;
+    std::condition_variable wakeUp_;
+    std::deque<Pending> pending_;
+    std::size_t peakInFlight_ = 0;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+//A truck booked through the carrier: deliverAsync() waits for the carrier's reply
+class CarrierTruck SEALED : public Transport {
+public:
+    explicit CarrierTruck(SimulatedCarrier& carrier) : carrier_(carrier) { }
+    std::string deliver() const override {
+        return std::string(deliverView());
+    }
+    std::string_view deliverView() const override {
+        LOGISTICS_PROBE(TransportKind::Truck, Deliver);
+        return Truck::deliverMessage;
+    }
+    Task<std::string> deliverAsync() const override {
+        LOGISTICS_PROBE(TransportKind::Truck, Deliver);
+        co_return co_await carrier_.request(Truck::deliverMessage);
+    }
+    double cost(const Order& order) const override {
+        return Truck().cost(order);
+    }
+    TransportKind kind() const override {
+        return TransportKind::Truck;
+    }
+
+private:
+    SimulatedCarrier& carrier_;
+};
+
+class CarrierLogistics SEALED : public Logistics {
+public:
+    CarrierLogistics(SimulatedCarrier& carrier, TransportPolicy policy) : Logistics(policy), carrier_(carrier) { }
+    Transport* createTransport() const override {
+        LOGISTICS_PROBE(TransportKind::Truck, CreateTransport);
+        return new CarrierTruck(carrier_);
+    }
+    Transport& createTransport(InlineTransport& holder) const override {
+        LOGISTICS_PROBE(TransportKind::Truck, CreateTransport);
+        return holder.emplace<CarrierTruck>(carrier_);
+    }
+
+private:
+    SimulatedCarrier& carrier_;
+};
+
+//Plans count deliveries at once through the carrier. Every plan must come back right, and the
+//carrier must have had more than one request waiting, which it only does if whenAll() kept
+//them in flight together instead of one after another.
+bool checkConcurrentDeliveries(const std::string& name, TransportPolicy policy, std::size_t count) {
+    std::size_t wrong = 0;
+    std::size_t peakInFlight = 0;
+    {
+        SimulatedCarrier carrier(std::chrono::milliseconds(20));
+        const CarrierLogistics logistics(carrier, policy);
+        std::vector<Task<std::string>> plans;
+        plans.reserve(count);
+        for (std::size_t i = 0; i < count; ++i) {
+            plans.push_back(logistics.planDeliveryAsync());
+        }
+        const std::vector<std::string> results = syncWait(whenAll(std::move(plans)));
+        const std::string expected = RoadLogistics().planDelivery();
+        wrong = count - results.size();
+        for (const std::string& result : results) {
+            wrong += result != expected;
+        }
+        peakInFlight = carrier.peakInFlight();
+    }
+    std::cout<<std::left<<std::setw(52)<<name;
+    if (wrong == 0 && peakInFlight > 1) {
+        std::cout<<"ok ("<<peakInFlight<<" in flight at once)\n";
+        return true;
+    }
+    std::cout<<"FAILED: "<<wrong<<" wrong plans, at most "<<peakInFlight<<" in flight at once\n";
+    return false;
+}
+
+int runSelfChecks() {
+    bool passed = true;
+    passed &= checkConcurrentDeliveries("planDeliveryAsync x200 via whenAll/PerCall", TransportPolicy::PerCall, 200);
+    passed &= checkConcurrentDeliveries("planDeliveryAsync x200 via whenAll/Pooled", TransportPolicy::Pooled, 200);
+    passed &= checkConcurrentDeliveries("planDeliveryAsync x200 via whenAll/PerThread", TransportPolicy::PerThread, 200);
+    std::cout<<(passed ? "All self checks passed\n" : "Some self checks FAILED\n");
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+//Load generation: run the program with --load [rate] [threads] [seconds].
+//Every thread issues rate requests per second (0 runs them back to back) for the given
+//number of seconds per mode. A request's latency is measured from the time it was due,
+//not from when it started, so a stall also counts against the requests queued behind it.
+//Latencies go into a log-linear histogram: each power of two is split into 32 buckets,
+//which keeps every recorded value within about 3% across the whole range.
+class LatencyHistogram {
+public:
+    static constexpr std::size_t subBucketBits = 5;
+    static constexpr std::size_t subBucketCount = std::size_t(1) << subBucketBits;
+    //Shifts run from 0 to 64 - (subBucketBits + 1), and each of them starts a row of buckets
+    static constexpr std::size_t bucketCount = (64 - subBucketBits + 1) * subBucketCount;
+
+    void record(std::uint64_t ns) {
+        ++counts_[index(ns)];
+        ++total_;
+        max_ = std::max(max_, ns);
+    }
+    void add(const LatencyHistogram& other) {
+        for (std::size_t i = 0; i < bucketCount; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+    std::uint64_t count() const { return total_; }
+    std::uint64_t max() const { return max_; }
+    //The upper edge of the bucket holding the q-th quantile, q in [0, 1]
+    std::uint64_t percentile(double q) const {
+        const auto rank = static_cast<std::uint64_t>(q * static_cast<double>(total_));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bucketCount; ++i) {
+            seen += counts_[i];
+            if (seen > rank) {
+                return std::min(upperEdge(i), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    //Values below 2 * subBucketCount get a bucket each; above, the top subBucketBits + 1
+    //bits of the value select the bucket within its power of two
+    static std::size_t index(std::uint64_t value) {
+        if (value < 2 * subBucketCount) {
+            return static_cast<std::size_t>(value);
+        }
+        std::size_t shift = 0;
+        while ((value >> shift) >= 2 * subBucketCount) {
+            ++shift;
+        }
+        return (shift + 1) * subBucketCount + static_cast<std::size_t>((value >> shift) - subBucketCount);
+    }
+    static std::uint64_t upperEdge(std::size_t index) {
+        if (index < 2 * subBucketCount) {
+            return index;
+        }
+        const std::size_t shift = index / subBucketCount - 1;
+        const std::uint64_t lower = static_cast<std::uint64_t>(index % subBucketCount + subBucketCount) << shift;
+        return lower + (std::uint64_t(1) << shift) - 1;
+    }
+
+    std::vector<std::uint64_t> counts_ = std::vector<std::uint64_t>(bucketCount);
+    std::uint64_t total_ = 0;
+    std::uint64_t max_ = 0;
+};
+
+struct LoadOptions {
+    //Requests per second per thread, fractions included; 0 runs them back to back
+    double rate = 20000;
+    std::size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    double seconds = 1.0;
+};
+
+//Parses [rate] [threads] [seconds]; an empty optional, after printing the usage, on bad input
+std::optional<LoadOptions> parseLoadOptions(int argc, char* argv[]) {
+    LoadOptions options;
+    const auto number = [](const char* text, double& value) {
+        char* end = nullptr;
+        value = std::strtod(text, &end);
+        return end != text && *end == '\0' && value >= 0.0;
+    };
+    double values[3] = {options.rate, static_cast<double>(options.threads), options.seconds};
+    //Upper bounds that keep the conversions below defined, and the run within reason
+    constexpr double limits[3] = {1e9, 4096.0, 86400.0};
+    //A slower rate would not issue a single request in the longest run
+    constexpr double minRate = 1.0 / limits[2];
+    for (int i = 0; i < argc; ++i) {
+        if (i >= 3 || !number(argv[i], values[i]) || !(values[i] <= limits[i]) ||
+            (i == 0 && values[i] != 0.0 && values[i] < minRate)) {
+            std::cerr<<"usage: --load [requests per second per thread, 0 for back to back] [threads] [seconds per mode]\n"
+                     <<"at least "<<minRate<<" and at most "<<limits[0]<<" requests per second, "<<limits[1]<<" threads and "<<limits[2]<<" seconds\n";
+            return std::nullopt;
+        }
+    }
+    options.rate = values[0];
+    options.threads = std::max<std::size_t>(1, static_cast<std::size_t>(values[1]));
+    options.seconds = values[2];
+    return options;
+}
+
+//Runs request(thread, i) on every thread for options.seconds and prints the latency percentiles
+template <typename Request>
+void runLoad(const std::string& name, const LoadOptions& options, Request request) {
+    using Clock = std::chrono::steady_clock;
+    const auto duration = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    const auto interval = options.rate == 0 ? Clock::duration::zero()
+                                            : std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double>(1.0 / options.rate));
+    std::vector<LatencyHistogram> histograms(options.threads);
+    std::vector<std::thread> threads;
+    threads.reserve(options.threads);
+    const Clock::time_point start = Clock::now();
+    const Clock::time_point stop = start + duration;
+    for (std::size_t t = 0; t < options.threads; ++t) {
+        threads.emplace_back([&, t] {
+            LatencyHistogram& histogram = histograms[t];
+            for (std::size_t i = 0;; ++i) {
+                Clock::time_point due = start + interval * static_cast<Clock::rep>(i);
+                if (interval == Clock::duration::zero()) {
+                    due = Clock::now();
+                }
+                if (due >= stop) {
+                    break;
+                }
+                while (Clock::now() < due) {
+                    std::this_thread::yield();
+                }
+                request(t, i);
+                histogram.record(static_cast<std::uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - due).count()));
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    LatencyHistogram all;
+    for (const LatencyHistogram& histogram : histograms) {
+        all.add(histogram);
+    }
+    std::cout<<std::left<<std::setw(36)<<name<<std::right<<std::fixed<<std::setprecision(0)
+             <<std::setw(10)<<static_cast<double>(all.count()) / elapsed<<" req/s"
+             <<"  p50 "<<std::setw(8)<<all.percentile(0.5)<<" ns"
+             <<"  p99 "<<std::setw(8)<<all.percentile(0.99)<<" ns"
+             <<"  p99.9 "<<std::setw(9)<<all.percentile(0.999)<<" ns"
+             <<"  max "<<std::setw(10)<<all.max()<<" ns\n";
+}
+
+//Every request plans one order, alternating between road and sea, into a buffer of its thread,
+//for each TransportPolicy: PerCall is the heap mode, Pooled and PerThread the pooled ones,
+//Cached and Inline the static ones that never allocate a transport per request.
+int runLoadGenerator(const LoadOptions& options) {
+    std::cout<<"Planning deliveries: "<<options.threads<<" threads, ";
+    if (options.rate == 0) {
+        std::cout<<"back to back";
+    } else {
+        std::cout<<options.rate<<" requests/s each";
+    }
+    std::cout<<", "<<options.seconds<<" s per mode\n";
+    struct alignas(64) Buffer {
+        std::string text;
+    };
+    std::vector<Buffer> buffers(options.threads);
+    for (Buffer& buffer : buffers) {
+        buffer.text.reserve(256);
+    }
+    const std::pair<const char*, TransportPolicy> policies[] = {
+        {"PerCall", TransportPolicy::PerCall}, {"Pooled", TransportPolicy::Pooled},
+        {"PerThread", TransportPolicy::PerThread}, {"Cached", TransportPolicy::Cached},
+        {"Inline", TransportPolicy::Inline}};
+    for (const auto& [policyName, policy] : policies) {
+        const RoadLogistics road(policy);
+        const ShipLogistics ship(policy);
+        const Logistics* const planners[transportKindCount] = {&road, &ship};
+        runLoad(std::string("Road+Ship/") + policyName, options, [&](std::size_t thread, std::size_t i) {
+            std::string& out = buffers[thread].text;
+            out.clear();
+            planners[i % transportKindCount]->planDelivery(Order{i, static_cast<double>(i % 2000)}, out);
+        });
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && std::strcmp(argv[1], "--bench") == 0) {
+        runBenchmarks();
+        return 0;
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--check-allocs") == 0) {
+        return runAllocationChecks();
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--self-check") == 0) {
+        return runSelfChecks();
+    }
+    if (argc > 1 && std::strcmp(argv[1], "--load") == 0) {
+        const std::optional<LoadOptions> options = parseLoadOptions(argc - 2, argv + 2);
+        return options ? runLoadGenerator(*options) : EXIT_FAILURE;
+    }
     Logistics* logistics = new RoadLogistics;
     std::cout<<logistics->planDelivery();
     Logistics* logistics2 = new ShipLogistics;
@@ -72,5 +1942,68 @@ int main()
 
     delete logistics;
     delete logistics2;
+
+    std::cout<<"\nReusing a single cached Truck and a pool of Ships, then a Truck on the stack\n";
+    const RoadLogistics cachedRoad(TransportPolicy::Cached);
+    const ShipLogistics pooledShip(TransportPolicy::Pooled);
+    ClientCode(cachedRoad);
+    ClientCode(cachedRoad);
+    ClientCode(pooledShip);
+    ClientCode(pooledShip);
+    ClientCode(RoadLogistics(TransportPolicy::Inline));
+    ClientCode(ShipLogistics(TransportPolicy::PerThread));
+
+    std::cout<<"\nWriting plans through a buffered sink\n";
+    std::cout.flush();
+    {
+        BufferedSink sink(stdout);
+        ClientCode(cachedRoad, sink);
+        ClientCode(pooledShip, sink);
+    }
+
+    std::cout<<"\nPicking the cheaper of road and sea for each order\n";
+    const MultiModalLogistics multiModal({&cachedRoad, &pooledShip});
+    const Order shipments[] = {{10, 120.0}, {11, 2400.0}};
+    for (const MultiModalLogistics::Plan& best : multiModal.planBest(shipments)) {
+        std::cout<<best.plan;
+    }
+
+    std::cout<<"\nPlanning deliveries asynchronously\n";
+    std::vector<Task<std::string>> plans;
+    plans.push_back(cachedRoad.planDeliveryAsync());
+    plans.push_back(pooledShip.planDeliveryAsync());
+    for (const std::string& plan : syncWait(whenAll(std::move(plans)))) {
+        std::cout<<plan;
+    }
+
+    std::cout<<"\nPlanning a batch of orders in parallel\n";
+    const Order orders[] = {{1}, {2}, {3}, {4}, {5}};
+    for (const std::string& plan : pooledShip.planDeliveries(orders)) {
+        std::cout<<plan;
+    }
+
+    std::cout<<"\nBatching a stream of orders by transport kind\n";
+    std::vector<std::string> batchedPlans[transportKindCount];
+    {
+        OrderBatcher batcher(cachedRoad, pooledShip,
+                             [&batchedPlans](TransportKind kind, std::span<const Order>, std::span<const std::string> plans) {
+                                 std::vector<std::string>& collected = batchedPlans[static_cast<std::size_t>(kind)];
+                                 collected.insert(collected.end(), plans.begin(), plans.end());
+                             },
+                             OrderBatchLimits{2, std::chrono::milliseconds(10), 16});
+        for (const Order& order : orders) {
+            batcher.submit(order.id % 2 == 0 ? TransportKind::Ship : TransportKind::Truck, order);
+        }
+    }
+    for (const std::vector<std::string>& plans : batchedPlans) {
+        for (const std::string& plan : plans) {
+            std::cout<<plan;
+        }
+    }
+
+#ifdef DESIGN_PATTERNS_INSTRUMENTATION
+    std::cout<<"\nInstrumentation snapshot\n";
+    Instrumentation::snapshot().print(std::cout);
+#endif
     return 0;
 }
\ No newline at end of file